@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <memory>
 #include <iostream>
@@ -13,7 +14,7 @@ using AstP = std::shared_ptr<Ast>;
 
 #include "error.hpp"
 
-enum class Type {
+enum class Type : uint8_t {
     Var=1,   // type variables, X
     Top,     // largest type
     Fn,      // function spaces, A->B
@@ -29,9 +30,10 @@ enum class Type {
 };
 
 
-struct Ast {
+struct Ast : Counted<Ast> {
     Type t;
     bool isPtr = false; // whether ref() is active [true] or n [false]
+    uint16_t name_bytes = 0; // heap bytes of name charged (MemBudget)
     std::string name; // informational only - for named variables
     intptr_t n = -1;  // de-Bruijn index for variables
     Traceback *err = nullptr; ///< Weak-ref. to error, only used
@@ -48,11 +50,25 @@ struct Ast {
     Ast(Type _t, const int _n)
                           : t(_t), n(_n), child{nullptr,nullptr} {}
     Ast(Type _t, const std::string& _name)
-                          : t(_t), name(_name), child{nullptr,nullptr} {}
+                          : t(_t), name(_name), child{nullptr,nullptr} {
+        charge_name();
+    }
     Ast(Type _t, const std::string& _name,
-            AstP c0)         : t(_t), name(_name), child{c0,nullptr} {}
+            AstP c0)         : t(_t), name(_name), child{c0,nullptr} {
+        charge_name();
+    }
     Ast(Type _t, const std::string& _name,
-            AstP c0, AstP c1) : t(_t), name(_name), child{c0,c1} {}
+            AstP c0, AstP c1) : t(_t), name(_name), child{c0,c1} {
+        charge_name();
+    }
+    // Names assigned after construction are not charged.
+    ~Ast() { mem_refund(budget, name_bytes); }
+    void charge_name() {
+        long n = heap_bytes(name);
+        if(n > 0 && n <= UINT16_MAX && mem_charge(n) != 0) {
+            name_bytes = n;
+        }
+    }
     TracebackP set_err(const std::string &name) {
         TracebackP tb = std::make_unique<Traceback>([=](std::ostream& os) {
                         os << name << std::endl;
@@ -165,6 +181,7 @@ static constexpr int getNChild(Type t) {
 
 // pprint.cpp
 void print_ast(std::ostream &os, AstP a, int indent=0);
+void print_dag(std::ostream &os, AstP a, int indent=0);
 inline std::ostream& operator <<(std::ostream& os, const AstP& a) {
     print_ast(os, a, 0);
     return os;
@@ -172,3 +189,11 @@ inline std::ostream& operator <<(std::ostream& os, const AstP& a) {
 
 // type.cpp
 TracebackP subType(AstP A, AstP B);
+
+// usage.cpp
+AstP drop_dead_lets(AstP a, int *ndropped = nullptr);
+AstP shift(AstP a, int d, int cutoff = 0);
+
+// parse.cpp
+AstP parse_module(ErrorList &err, const std::string &text,
+                  const std::string &fname);
@@ -0,0 +1,192 @@
+#include <chrono>
+#include <sstream>
+#include <stdio.h>
+
+#include "ast.hpp"
+#include "stack.hpp"
+#include "unwind.hpp"
+#include "bench.hpp"
+#include "flat.hpp"
+#include "erase.hpp"
+
+// Let T_1 = ... in ... Let T_depth = ... in fn(x:T_depth) x
+static AstP aliases(int depth) {
+    AstP body = fn("x", Var("T" + std::to_string(depth)), var("x"));
+    for(int k=depth; k>=1; --k) {
+        AstP A = k == 1 ? Top() : Var("T" + std::to_string(k-1));
+        AstP C = Var("C");
+        AstP rhs = ForAll("C", Top(), Fn(Fn(A, Fn(A, C)), C));
+        body = appT(fnT("T" + std::to_string(k), Top(), body), rhs);
+    }
+    return body;
+}
+
+// Check one term, printing a line of statistics.
+static bool bench_one(std::ostream &os, const char *name, int n, AstP a) {
+    long stacks = Counted<Stack>::stat.total;
+    long asts = Counted<Ast>::stat.total;
+    auto t0 = std::chrono::steady_clock::now();
+
+    ErrorList err;
+    numberAst(err, &a);
+    if(err.ok()) {
+        Stack *s = new Stack(err, nullptr, a, false);
+        if(err.ok()) get_type(err, s);
+        stack_dtor(s);
+    }
+
+    std::chrono::duration<double, std::milli> dt =
+                    std::chrono::steady_clock::now() - t0;
+    char line[128];
+    snprintf(line, sizeof(line), "  %-8s %4d %10.3f ms %10ld Stack %10ld Ast%s\n",
+             name, n, dt.count(),
+             Counted<Stack>::stat.total - stacks,
+             Counted<Ast>::stat.total - asts,
+             err.ok() ? "" : "  FAILED");
+    os << line;
+    return err.ok();
+}
+
+int bench_aliases(std::ostream &os, int depth) {
+    int failed = 0;
+    for(int k=1; k<=depth; ++k) {
+        if(!bench_one(os, "aliases", k, aliases(k))) ++failed;
+    }
+    return failed;
+}
+
+/* All(X<:Top)^nbind followed by a balanced tree of Fn-s with
+ * nvar leaves.  Every third leaf is a pointer variable to one of
+ * nbind fake binders (keys are never dereferenced), the others
+ * are indices, some pointing outside the type.
+ */
+static AstP wide_type(int nvar, int nbind, int lo = 0) {
+    if(nvar == 1) {
+        AstP v = Var(lo % (2*nbind));
+        if(lo % 3 == 0) {
+            v->isPtr = true;
+            v->n = 0x1000 + 16*(lo % nbind);
+        }
+        return v;
+    }
+    return Fn(wide_type(nvar/2, nbind, lo),
+              wide_type(nvar - nvar/2, nbind, lo + nvar/2));
+}
+
+static std::string to_string(AstP a) {
+    std::ostringstream os;
+    os << a;
+    return os.str();
+}
+
+int bench_renumber(std::ostream &os, int nvar) {
+    using clock = std::chrono::steady_clock;
+    auto ms = [](clock::duration d) {
+        return std::chrono::duration<double, std::milli>(d).count();
+    };
+    const int nbind = 4;
+    AstP a = wide_type(nvar, nbind);
+    for(int k=0; k<nbind; ++k) {
+        a = ForAll("X", Top(), a);
+    }
+    std::map<intptr_t,int> map;
+    for(int k=0; k<nbind; ++k) {
+        map[0x1000 + 16*k] = k;
+    }
+
+    // Tree walks.
+    auto t0 = clock::now();
+    AstP tree = replaceVars(a, map, 0);
+    tree = shift(tree, 3, 2);
+    auto t1 = clock::now();
+
+    FlatAst f = flatten(a);
+    auto t2 = clock::now();
+    flat_close(f, map, 0);
+    flat_shift(f, 3, 2);
+    auto t3 = clock::now();
+    AstP flat = unflatten(f);
+    auto t4 = clock::now();
+
+    bool same = to_string(tree) == to_string(flat);
+    char line[160];
+    snprintf(line, sizeof(line),
+             "  renumber %zu nodes (%s): tree %.3f ms, flatten %.3f ms,"
+             " kernels %.3f ms, unflatten %.3f ms%s\n",
+             f.size(), flat_simd ? "simd" : "scalar",
+             ms(t1-t0), ms(t2-t1), ms(t3-t2), ms(t4-t3),
+             same ? "" : "  MISMATCH");
+    os << line;
+    return same ? 0 : 1;
+}
+
+// Church numerals, N = All(X<:Top) (X->X) -> X -> X.
+static AstP church(int k) {
+    AstP x = var("x");
+    for(int i=0; i<k; ++i) {
+        x = app(var("f"), x);
+    }
+    return fnT("X", Top(), fn("f", Fn(Var("X"), Var("X")),
+                              fn("x", Var("X"), x)));
+}
+
+// Let N = ... in (fn(m:N) fn(n:N) fn(X<:Top) fn(f:X->X)
+//                   n(:X->X)(m(:X))(f))(2)(k),
+// which is 2^k (with the type arguments a checker inserts).
+static AstP church_pow(int k) {
+    AstP X = Var("X");
+    AstP pow = fn("m", Var("N"), fn("n", Var("N"),
+                fnT("X", Top(), fn("f", Fn(X, X),
+                    app(app(appT(var("n"), Fn(X, X)), appT(var("m"), X)),
+                        var("f"))))));
+    AstP N = ForAll("X", Top(), Fn(Fn(Var("X"), Var("X")),
+                                   Fn(Var("X"), Var("X"))));
+    return appT(fnT("N", Top(), app(app(pow, church(2)), church(k))), N);
+}
+
+int bench_erase(std::ostream &os, int n) {
+    using clock = std::chrono::steady_clock;
+    auto ms = [](clock::duration d) {
+        return std::chrono::duration<double, std::milli>(d).count();
+    };
+    int failed = 0;
+    for(int k=1; k<=n; ++k) {
+        ErrorList err;
+        AstP a = church_pow(k);
+        numberAst(err, &a);
+        Stack *s = err.ok() ? new Stack(err, nullptr, a, false) : nullptr;
+        if(err.ok()) get_type(err, s);
+        if(s) stack_dtor(s);
+        if(!err.ok()) {
+            os << "  erase    " << k << "  FAILED\n" << err;
+            ++failed;
+            continue;
+        }
+
+        // Typed: wind the checked term and evaluate it.
+        long stacks = Counted<Stack>::stat.total;
+        auto t0 = clock::now();
+        s = new Stack(err, nullptr, a, false);
+        eval_need(s);
+        auto t1 = clock::now();
+        stacks = Counted<Stack>::stat.total - stacks;
+        AstP typed = erase(get_ast(s));
+        stack_dtor(s);
+
+        // Erased: no Stacks are built.
+        auto t2 = clock::now();
+        AstP untyped = normalize(erase(a));
+        auto t3 = clock::now();
+
+        bool same = to_string(typed) == to_string(untyped);
+        if(!same) ++failed;
+        char line[160];
+        snprintf(line, sizeof(line),
+                 "  erase    %4d eval_need %10.3f ms %10ld Stack,"
+                 " erased %10.3f ms%s\n",
+                 k, ms(t1-t0), stacks, ms(t3-t2),
+                 same ? "" : "  MISMATCH");
+        os << line;
+    }
+    return failed;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <iostream>
+
+/** Synthetic benchmarks (bench.cpp).
+ *
+ *  Each builds a family of terms of growing size, checks them,
+ *  and prints one line per size with the time taken and the
+ *  number of nodes constructed.  Returns the number of terms
+ *  that failed to check.
+ */
+
+// Nested type aliases, T_k = All(C<:Top) (T_{k-1} -> T_{k-1} -> C) -> C,
+// used as the annotation of fn(x:T_depth) x.
+int bench_aliases(std::ostream &os, int depth);
+
+// Shifting and closing over binders (pointer variables to
+// indices) for types with `nvar` variables, comparing
+// tree walks (shift, replaceVars) with the flat.hpp kernels.
+int bench_renumber(std::ostream &os, int nvar);
+
+// Evaluating 2^k with Church numerals (k = 1..n), by eval_need
+// on the checked term and by normalize on its erasure.
+int bench_erase(std::ostream &os, int n);
@@ -0,0 +1,212 @@
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "erase.hpp"
+#include "stack.hpp"
+#include "unwind.hpp"
+#include "profile.hpp"
+
+/* Erasure removes type binders, so indices are renumbered
+ * to count only the term binders between a variable and its
+ * binder.  kept[i] is true if the i-th enclosing binder
+ * (counting from the root) is a term binder.
+ */
+struct Erase {
+    std::vector<bool> kept;
+    AstP T = Top(); // shared by all annotations
+
+    AstP run(AstP a) {
+        switch(a->t) {
+        case Type::var:
+            return index(a);
+        case Type::top:
+            return a;
+        case Type::fn: {
+            kept.push_back(true);
+            AstP b = run(a->child[1]);
+            kept.pop_back();
+            return fn(a->name, T, b);
+        }
+        case Type::fnT: {
+            kept.push_back(false);
+            AstP b = run(a->child[1]);
+            kept.pop_back();
+            return b;
+        }
+        case Type::app:
+            return app(run(a->child[0]), run(a->child[1]));
+        case Type::appT:
+            return run(a->child[0]);
+        default:
+            throw std::runtime_error("Cannot erase a type.");
+        }
+    }
+
+    AstP index(AstP a) {
+        intptr_t depth = kept.size();
+        if(a->isPtr) {
+            return global(a->ref());
+        }
+        if(a->n < 0 || a->n >= depth) {
+            throw std::runtime_error("Cannot erase an open term.");
+        }
+        if(!kept[depth-1-a->n]) {
+            throw std::runtime_error("Cannot erase a type variable.");
+        }
+        intptr_t n = 0;
+        for(intptr_t i=depth-a->n; i<depth; ++i) {
+            n += kept[i];
+        }
+        AstP y = std::make_shared<Ast>(Type::var, a->name);
+        y->n = n;
+        return y;
+    }
+
+    // A pointer variable to a top-level entry (TopEnv) is replaced
+    // by its erased term, which is closed, so it is shared.
+    AstP global(Bind *c) {
+        if(c->rhs == nullptr || bindType(c->t)) {
+            throw std::runtime_error("Cannot erase an open term.");
+        }
+        auto it = globals.find(c);
+        if(it != globals.end()) return it->second;
+        std::vector<bool> outer;
+        outer.swap(kept);
+        AstP y = run(get_ast(c->rhs));
+        kept.swap(outer);
+        globals[c] = y;
+        return y;
+    }
+    std::unordered_map<const Bind *, AstP> globals;
+};
+
+AstP erase(AstP a) {
+    PROFILE("erase");
+    Erase E;
+    return E.run(a);
+}
+
+/* Normalization by evaluation.
+ *
+ * A term is evaluated to a Val in an environment of Thunks, one
+ * per enclosing binder.  Arguments are Thunks too, evaluated at
+ * most once, when their variable is first needed (call by need).
+ * The normal form is then read back from the Val, applying every
+ * function to a fresh variable to normalize its body.
+ */
+namespace {
+
+struct Val;
+struct Thunk;
+struct Env;
+using ValP = std::shared_ptr<Val>;
+using ThunkP = std::shared_ptr<Thunk>;
+using EnvP = std::shared_ptr<Env>;
+
+// Persistent list of Thunks, innermost binder first.
+struct Env {
+    ThunkP x;
+    EnvP next;
+};
+
+struct Thunk {
+    AstP code; // cleared once evaluated
+    EnvP env;
+    ValP val;
+};
+
+struct Val {
+    enum Kind { Unit, Closure, Var, App } kind;
+    AstP body;   // Closure: fn body
+    EnvP env;    // Closure: its environment
+    int level;   // Var: the binder, counting from the root
+    ValP fun;    // App: a stuck application fun(arg)
+    ThunkP arg;
+
+    Val(Kind k) : kind(k), level(0) {}
+};
+
+struct Normalize {
+    ValP unit = std::make_shared<Val>(Val::Unit);
+    AstP T = Top();
+
+    ValP force(const ThunkP &x) {
+        if(x->val == nullptr) {
+            x->val = eval(x->code, x->env);
+            x->code = nullptr;
+            x->env = nullptr;
+        }
+        return x->val;
+    }
+
+    ValP eval(const AstP &a, const EnvP &env) {
+        switch(a->t) {
+        case Type::var: {
+            const Env *e = env.get();
+            for(intptr_t i=0; i<a->n; ++i) e = e->next.get();
+            return force(e->x);
+        }
+        case Type::top:
+            return unit;
+        case Type::fn: {
+            ValP v = std::make_shared<Val>(Val::Closure);
+            v->body = a->child[1];
+            v->env = env;
+            return v;
+        }
+        case Type::app: {
+            ValP f = eval(a->child[0], env);
+            ThunkP x = std::make_shared<Thunk>();
+            x->code = a->child[1];
+            x->env = env;
+            return apply(f, x);
+        }
+        default:
+            throw std::runtime_error("Cannot normalize a typed term.");
+        }
+    }
+
+    ValP apply(const ValP &f, const ThunkP &x) {
+        switch(f->kind) {
+        case Val::Closure:
+            return eval(f->body, std::make_shared<Env>(Env{x, f->env}));
+        case Val::Var:
+        case Val::App: {
+            ValP v = std::make_shared<Val>(Val::App);
+            v->fun = f;
+            v->arg = x;
+            return v;
+        }
+        default:
+            throw std::runtime_error("Applied top.");
+        }
+    }
+
+    // Read back v under `depth` binders.
+    AstP quote(const ValP &v, int depth) {
+        switch(v->kind) {
+        case Val::Unit:
+            return top();
+        case Val::Closure: {
+            ThunkP x = std::make_shared<Thunk>();
+            x->val = std::make_shared<Val>(Val::Var);
+            x->val->level = depth;
+            return fn("", T, quote(apply(v, x), depth+1));
+        }
+        case Val::Var:
+            return var(depth-1-v->level);
+        case Val::App:
+            return app(quote(v->fun, depth), quote(force(v->arg), depth));
+        }
+        return nullptr;
+    }
+};
+
+} // namespace
+
+AstP normalize(AstP a) {
+    PROFILE("normalize");
+    Normalize N;
+    return N.quote(N.eval(a, nullptr), 0);
+}
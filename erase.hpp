@@ -0,0 +1,24 @@
+#pragma once
+
+#include "ast.hpp"
+
+/** Type-erased runtime terms.
+ *
+ *  Once a term has been checked, its types are not needed
+ *  to compute its value.  erase() drops them: fn(X<:A) b becomes b,
+ *  a(:B) becomes a, and the annotation of every fn(x:A) b is
+ *  replaced by Top.  What is left is an untyped, numbered Ast
+ *  over var, top, fn and app only.
+ *
+ *  normalize() evaluates such a term by need, under binders,
+ *  directly on the Ast (no Stacks, Binds or types are built).
+ *  For a checked term a, normalize(erase(a)) is the erasure
+ *  of its eval_need result.
+ */
+
+// Throws std::runtime_error if a is not a closed, numbered term.
+// Pointer variables to top-level entries are replaced by their
+// (erased) definitions.
+AstP erase(AstP a);
+// Normal form of an erased term.  Does not return if there is none.
+AstP normalize(AstP a);
@@ -6,6 +6,8 @@
 #include <functional>
 #include <iostream>
 
+#include "memstat.hpp"
+
 // TODO: make a better error tree, e.g.
 //
 // Errors = Error TBPrint           // node
@@ -19,17 +21,32 @@ typedef std::function<void(std::ostream& os)> TBPrint;
 
 struct ErrorList {
     std::vector<TracebackP> errors;
+    /// Error budget (0 = unlimited).  Once it is used up, further
+    //  errors are dropped and winding stops at the next safe point.
+    size_t max_errors = 0;
+    /// Why checking stopped early, if not at the error budget
+    //  (e.g. "out of fuel"), or nullptr.
+    const char *stopped = nullptr;
 
     void append(TracebackP &&err) {
-        if(!err) return;
+        if(!err || full()) return;
         errors.emplace_back(std::move(err));
     }
+    // Record err, and stop at the next safe point (as if full).
+    void stop(TracebackP &&err, const char *why) {
+        append(std::move(err));
+        stopped = why;
+    }
     bool ok() {
         return errors.size() == 0;
     }
+    bool full() const {
+        return stopped != nullptr
+            || (max_errors > 0 && errors.size() >= max_errors);
+    }
 };
 
-struct Traceback {
+struct Traceback : Counted<Traceback> {
     int depth = 0;
     TBPrint what;
     TracebackP next;
@@ -73,6 +90,11 @@ inline std::ostream& operator <<(std::ostream& os, const ErrorList& err) {
         os << *(err.errors[i]);
         os << std::endl;
     }
+    if(err.stopped) {
+        os << "Stopped checking: " << err.stopped << ".\n";
+    } else if(err.full()) {
+        os << "Stopped checking at the error budget.\n";
+    }
     return os;
 }
 
@@ -81,6 +103,6 @@ inline TracebackP mkError(const std::string &name) {
 }
 
 inline TracebackP mkTB(const TBPrint &what, TracebackP &&next) {
-    if(!next) return next;
+    if(!next) return nullptr;
     return std::make_unique<Traceback>(what, std::move(next));
 }
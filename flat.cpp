@@ -0,0 +1,103 @@
+#include "flat.hpp"
+
+#if defined(FSUB_SIMD) && defined(__GNUC__)
+#define FLAT_SIMD 1
+// Two 64-bit lanes, which GCC lowers to SSE2 on any x86-64
+// (and to NEON or scalar code elsewhere).
+typedef int64_t vec __attribute__((vector_size(16), may_alias, aligned(8)));
+static constexpr size_t lanes = sizeof(vec) / sizeof(int64_t);
+const bool flat_simd = true;
+
+static inline vec load(const int64_t *p) {
+    return *(const vec *)p;
+}
+static inline void store(int64_t *p, vec x) {
+    *(vec *)p = x;
+}
+#else
+const bool flat_simd = false;
+#endif
+
+static void flatten1(FlatAst &f, const AstP &a, int64_t depth) {
+    size_t i = f.t.size();
+    f.t.push_back(a->t);
+    f.name.push_back(a->name);
+    f.c1.push_back(-1);
+    f.kind.push_back(a->t == Type::Var || a->t == Type::var
+                        ? (a->isPtr ? FlatAst::Ptr : FlatAst::Index)
+                        : FlatAst::Other);
+    f.n.push_back(a->n);
+    f.depth.push_back(depth);
+    if(getNChild(a->t) == 0) return;
+    flatten1(f, a->child[0], depth);
+    f.c1[i] = f.t.size();
+    flatten1(f, a->child[1], isBind(a->t) ? depth+1 : depth);
+}
+
+FlatAst flatten(AstP a) {
+    FlatAst f;
+    flatten1(f, a, 0);
+    return f;
+}
+
+static AstP unflatten1(const FlatAst &f, size_t i) {
+    AstP y = std::make_shared<Ast>(f.t[i], f.name[i]);
+    y->isPtr = f.kind[i] == FlatAst::Ptr;
+    y->n = f.n[i];
+    if(getNChild(f.t[i]) > 0) {
+        y->child[0] = unflatten1(f, i+1);
+        y->child[1] = unflatten1(f, f.c1[i]);
+    }
+    return y;
+}
+
+AstP unflatten(const FlatAst &f) {
+    return unflatten1(f, 0);
+}
+
+/* Both kernels are branch-free per node: a lane mask selects
+ * the nodes to change, and every node is written back.
+ */
+void flat_shift(FlatAst &f, int64_t d, int64_t cutoff) {
+    size_t N = f.size(), i = 0;
+    int64_t *n = f.n.data();
+    const int64_t *kind = f.kind.data(), *depth = f.depth.data();
+#ifdef FLAT_SIMD
+    for(; i+lanes <= N; i += lanes) {
+        vec ni = load(n+i);
+        vec m = (load(kind+i) == (int64_t)FlatAst::Index)
+             & (ni - load(depth+i) >= cutoff);
+        store(n+i, ni + (m & d));
+    }
+#endif
+    for(; i < N; ++i) { // scalar fallback and remainder
+        int64_t m = -(int64_t)(kind[i] == FlatAst::Index
+                                && n[i] - depth[i] >= cutoff);
+        n[i] += m & d;
+    }
+}
+
+void flat_close(FlatAst &f, const std::map<intptr_t,int> &map,
+                int64_t ndown) {
+    size_t N = f.size();
+    int64_t *n = f.n.data(), *kind = f.kind.data();
+    const int64_t *depth = f.depth.data();
+    // One pass per binder: types close over a handful of them.
+    for(auto &kv : map) {
+        int64_t key = kv.first, base = ndown + kv.second;
+        size_t i = 0;
+#ifdef FLAT_SIMD
+        for(; i+lanes <= N; i += lanes) {
+            vec ni = load(n+i), ki = load(kind+i);
+            vec m = (ki == (int64_t)FlatAst::Ptr) & (ni == key);
+            store(n+i, (m & (load(depth+i) + base)) | (~m & ni));
+            store(kind+i, (m & (int64_t)FlatAst::Index) | (~m & ki));
+        }
+#endif
+        for(; i < N; ++i) {
+            int64_t m = -(int64_t)(kind[i] == FlatAst::Ptr && n[i] == key);
+            n[i] = (m & (depth[i] + base)) | (~m & n[i]);
+            kind[i] = (m & FlatAst::Index) | (~m & kind[i]);
+        }
+    }
+}
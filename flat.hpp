@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+
+/** A tree-shaped Ast stored as a flat node array, in pre-order
+ *  and column-wise (structure of arrays).
+ *
+ *  Node i's first child is node i+1 and its second child is
+ *  c1[i].  Every column that the bulk kernels below touch
+ *  is 64 bits wide, so that they run as straight-line maps over
+ *  whole vectors of nodes.
+ *
+ *  Shared sub-trees are copied per occurrence, since the
+ *  binder depth (and hence the meaning of an index) differs.
+ */
+struct FlatAst {
+    enum Kind : int64_t {
+        Other = 0, ///< not a variable
+        Index = 1, ///< de-Bruijn indexed variable
+        Ptr = 2    ///< pointer variable (n is a Bind *)
+    };
+
+    std::vector<Type> t;
+    std::vector<std::string> name;
+    std::vector<int32_t> c1;
+    // Kernel columns.
+    std::vector<int64_t> kind;
+    std::vector<int64_t> n;     ///< index, or pointer if kind == Ptr
+    std::vector<int64_t> depth; ///< number of binders above the node
+
+    size_t size() const { return t.size(); }
+};
+
+FlatAst flatten(AstP a);
+AstP unflatten(const FlatAst &f);
+
+/** Add d to every index pointing outside the first `cutoff`
+ *  binders of the whole tree.
+ */
+void flat_shift(FlatAst &f, int64_t d, int64_t cutoff);
+
+/** Bulk version of replaceVars(a, map, ndown): every pointer
+ *  variable whose Bind is a key of map becomes an index,
+ *  ndown + (binders above it) + map[key].
+ */
+void flat_close(FlatAst &f, const std::map<intptr_t,int> &map, int64_t ndown);
+
+// true if the kernels were compiled with vector instructions
+extern const bool flat_simd;
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+
+/** Step budget for one request.
+ *
+ *  Winding, subType1 and eval_need each spend one unit per
+ *  step, from the Fuel installed (per thread) by a FuelScope.
+ *  Without a FuelScope, fuel is unlimited.
+ *
+ *  Running out is reported differently per operation:
+ *  - wind (and so checking) records an "Out of fuel." error
+ *    and stops at the next safe point, as for the error budget;
+ *  - subType fails with an "Out of fuel" traceback;
+ *  - eval_need returns false, leaving a partially evaluated stack.
+ *    The stack is its own state, so calling eval_need again
+ *    (with more fuel) resumes where it stopped.
+ */
+struct Fuel {
+    // Atomic, since the tasks of eval_need_parallel share it.
+    std::atomic<long> left{-1}; ///< remaining steps (-1 = unlimited)
+
+    Fuel() {}
+    explicit Fuel(long n) : left(n) {}
+
+    bool spend() {
+        long n = left.load(std::memory_order_relaxed);
+        while(n > 0 && !left.compare_exchange_weak(n, n-1,
+                                                   std::memory_order_relaxed));
+        return n != 0;
+    }
+    bool empty() const {
+        return left == 0;
+    }
+
+    static thread_local Fuel *cur;
+};
+
+// Install f as the fuel for this thread, while in scope.
+struct FuelScope {
+    Fuel *prev;
+    FuelScope(Fuel &f) : prev(Fuel::cur) { Fuel::cur = &f; }
+    ~FuelScope() { Fuel::cur = prev; }
+};
+
+// Spend one step.  Returns false if the budget is exhausted.
+inline bool spend_fuel() {
+    return Fuel::cur == nullptr || Fuel::cur->spend();
+}
+inline bool out_of_fuel() {
+    return Fuel::cur != nullptr && Fuel::cur->empty();
+}
@@ -0,0 +1,1512 @@
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "ast.hpp"
+#include "stack.hpp"
+#include "unwind.hpp"
+#include "gen.hpp"
+#include "fuel.hpp"
+#include "pool.hpp"
+#include "erase.hpp"
+#include "prelude.hpp"
+#include "image.hpp"
+#include "flat.hpp"
+#include "profile.hpp"
+#include "server.hpp"
+
+/** Generator of well-typed named terms.
+ *
+ *  Terms are built bottom-up while tracking their types
+ *  (gen_term), and top-down against an expected type when
+ *  they are used as an argument (gen_check).  All binders
+ *  get fresh names, so named types can be compared
+ *  structurally and substituted without capture.
+ *
+ *  Type variables are bounded by Top or by an earlier type,
+ *  and type applications instantiate with the bound itself
+ *  when it is not Top, so no subtyping search is needed.
+ */
+struct Gen {
+    struct TVar { std::string name; AstP bound; };
+    struct Val  { std::string name; AstP type; };
+    // Re-usable sub-trees, valid while the scopes they were
+    // built in (tenv.size() and env.size()) are still open.
+    struct Pooled { AstP a, type; size_t ntv, nv; };
+
+    const GenOptions &opt;
+    std::mt19937 rng;
+    int fresh = 0;
+    int budget;
+    std::vector<TVar> tenv;
+    std::vector<Val> env;
+    std::vector<Pooled> types, terms;
+
+    Gen(const GenOptions &_opt, unsigned seed)
+        : opt(_opt), rng(seed), budget(_opt.size) {}
+
+    int pick(int n) {
+        return std::uniform_int_distribution<int>(0, n-1)(rng);
+    }
+    bool coin(double p) {
+        return std::uniform_real_distribution<double>(0.0, 1.0)(rng) < p;
+    }
+    std::string name(const char *prefix) {
+        return prefix + std::to_string(++fresh);
+    }
+
+    void push_type(const std::string &X, AstP bound) {
+        tenv.push_back({X, bound});
+    }
+    void pop_type() {
+        tenv.pop_back();
+        prune();
+    }
+    void push_val(const std::string &x, AstP A) {
+        env.push_back({x, A});
+    }
+    void pop_val() {
+        env.pop_back();
+        prune();
+    }
+    void prune() {
+        while(types.size() && types.back().ntv > tenv.size())
+            types.pop_back();
+        while(terms.size() && (terms.back().ntv > tenv.size()
+                            || terms.back().nv > env.size()))
+            terms.pop_back();
+    }
+
+    AstP gen_type(int d) {
+        --budget;
+        if(types.size() && coin(opt.share)) {
+            return types[pick(types.size())].a;
+        }
+        AstP A;
+        int k = (d <= 0 || budget <= 0) ? 0 : pick(10);
+        if(k < 3) { // leaf
+            if(tenv.size() && coin(0.7)) {
+                A = Var(tenv[pick(tenv.size())].name);
+            } else {
+                A = Top();
+            }
+        } else if(k < 8) {
+            AstP B = gen_type(d-1);
+            A = Fn(B, gen_type(d-1));
+        } else {
+            std::string X = name("X");
+            AstP bound = coin(0.7) ? Top() : gen_type(d-1);
+            push_type(X, bound);
+            AstP B = gen_type(d-1);
+            pop_type();
+            A = ForAll(X, bound, B);
+        }
+        types.push_back({A, nullptr, tenv.size(), env.size()});
+        return A;
+    }
+
+    AstP gen_term(int d, AstP *ty) {
+        --budget;
+        if(terms.size() && coin(opt.share)) {
+            Pooled &p = terms[pick(terms.size())];
+            *ty = p.type;
+            return p.a;
+        }
+        AstP a;
+        int k = (d <= 0 || budget <= 0) ? 0 : pick(10);
+        if(k < 2) { // leaf
+            if(env.size() && coin(0.8)) {
+                Val &v = env[pick(env.size())];
+                *ty = v.type;
+                return var(v.name);
+            }
+            *ty = Top();
+            return top();
+        } else if(k < 4) {
+            std::string x = name("x");
+            AstP A = gen_type(d-1), B;
+            push_val(x, A);
+            AstP b = gen_term(d-1, &B);
+            pop_val();
+            *ty = Fn(A, B);
+            a = fn(x, A, b);
+        } else if(k < 5) {
+            std::string X = name("X");
+            AstP bound = coin(0.7) ? Top() : gen_type(d-1), B;
+            push_type(X, bound);
+            AstP b = gen_term(d-1, &B);
+            pop_type();
+            *ty = ForAll(X, bound, B);
+            a = fnT(X, bound, b);
+        } else if(k < 8) {
+            AstP F;
+            AstP f = gen_term(d-1, &F);
+            a = f; *ty = F;
+            if(F->t == Type::Fn) {
+                AstP arg = gen_check(d-1, F->child[0]);
+                if(arg) {
+                    a = app(f, arg);
+                    *ty = F->child[1];
+                }
+            } else if(F->t == Type::ForAll) {
+                AstP bound = F->child[0];
+                AstP T = bound->t == Type::Top ? gen_type(d-1) : bound;
+                a = appT(f, T);
+                *ty = subst(F->child[1], F->name, T);
+            }
+        } else { // let
+            AstP A, B;
+            AstP rhs = gen_term(d-1, &A);
+            std::string x = name("x");
+            push_val(x, A);
+            AstP b = gen_term(d-1, &B);
+            pop_val();
+            *ty = B;
+            a = app(fn(x, A, b), rhs);
+        }
+        terms.push_back({a, *ty, tenv.size(), env.size()});
+        return a;
+    }
+
+    // Generate a term of type T, or return nullptr if
+    // no inhabitant is easily found.
+    AstP gen_check(int d, AstP T) {
+        --budget;
+        std::vector<int> match;
+        for(int i=0; i<(int)env.size(); ++i) {
+            if(equal(env[i].type, T)) match.push_back(i);
+        }
+        if(match.size() && (coin(0.5) || d <= 0 || budget <= 0)) {
+            return var(env[match[pick(match.size())]].name);
+        }
+        switch(T->t) {
+        case Type::Top: {
+            AstP ignored;
+            return gen_term(d, &ignored);
+        }
+        case Type::Fn: {
+            std::string x = name("x");
+            push_val(x, T->child[0]);
+            AstP b = gen_check(d-1, T->child[1]);
+            pop_val();
+            return b ? fn(x, T->child[0], b) : nullptr;
+        }
+        case Type::ForAll: {
+            std::string X = name("X");
+            push_type(X, T->child[0]);
+            AstP b = gen_check(d-1, subst(T->child[1], T->name, Var(X)));
+            pop_type();
+            return b ? fnT(X, T->child[0], b) : nullptr;
+        }
+        case Type::Var:
+            // Try a function in scope returning T.
+            // (by index, since gen_check may grow env)
+            for(size_t i=0; d > 0 && i<env.size(); ++i) {
+                Val v = env[i];
+                if(v.type->t == Type::Fn && equal(v.type->child[1], T)) {
+                    AstP arg = gen_check(d-1, v.type->child[0]);
+                    if(arg) return app(var(v.name), arg);
+                }
+            }
+            return match.size() ? var(env[match[0]].name) : nullptr;
+        default:
+            return nullptr;
+        }
+    }
+
+    // Capture-free, since all binder names are fresh.
+    static AstP subst(AstP A, const std::string &X, AstP U) {
+        switch(A->t) {
+        case Type::Var:
+            return A->name == X ? U : A;
+        case Type::Fn:
+        case Type::ForAll: {
+            AstP c0 = subst(A->child[0], X, U);
+            AstP c1 = A->name == X ? A->child[1] : subst(A->child[1], X, U);
+            if(c0 == A->child[0] && c1 == A->child[1]) return A;
+            return std::make_shared<Ast>(A->t, A->name, c0, c1);
+        }
+        default:
+            return A;
+        }
+    }
+    static bool equal(AstP A, AstP B) {
+        if(A == B) return true;
+        if(A->t != B->t || A->name != B->name) return false;
+        for(int i=0; i<getNChild(A->t); ++i) {
+            if(!equal(A->child[i], B->child[i])) return false;
+        }
+        return true;
+    }
+};
+
+AstP gen_term(const GenOptions &opt, unsigned seed, AstP *type) {
+    Gen G(opt, seed);
+    return G.gen_term(opt.depth, type);
+}
+
+void print_named(std::ostream &os, AstP a) {
+    switch(a->t) {
+    case Type::Var:
+    case Type::var:
+        os << a->name;
+        break;
+    case Type::Top:
+        os << "Top";
+        break;
+    case Type::top:
+        os << "top";
+        break;
+    case Type::Fn:
+        os << "(";
+        print_named(os, a->child[0]);
+        os << ") -> ";
+        print_named(os, a->child[1]);
+        break;
+    case Type::ForAll:
+    case Type::fnT:
+        os << (a->t == Type::ForAll ? "All(" : "fn(") << a->name << "<:";
+        print_named(os, a->child[0]);
+        os << ") ";
+        print_named(os, a->child[1]);
+        break;
+    case Type::fn:
+        os << "fn(" << a->name << ":";
+        print_named(os, a->child[0]);
+        os << ") ";
+        print_named(os, a->child[1]);
+        break;
+    case Type::app:
+    case Type::appT:
+        os << "(";
+        print_named(os, a->child[0]);
+        os << (a->t == Type::app ? ")(" : ")(:");
+        print_named(os, a->child[1]);
+        os << ")";
+        break;
+    default:
+        os << "{?}";
+        break;
+    }
+}
+
+// Structural equality of numbered Ast-s (names are ignored).
+static bool same_ast(AstP A, AstP B) {
+    if(A == B) return true;
+    if(!A || !B || A->t != B->t) return false;
+    if(A->t == Type::Var || A->t == Type::var) {
+        return A->isPtr == B->isPtr && A->n == B->n;
+    }
+    for(int i=0; i<getNChild(A->t); ++i) {
+        if(!same_ast(A->child[i], B->child[i])) return false;
+    }
+    return true;
+}
+static bool same_type(AstP A, AstP B) {
+    return !subType(A, B) && !subType(B, A);
+}
+
+struct CheckResult {
+    bool well_typed = false; // numbered and checked with no errors
+    std::string failure;     // description of a broken invariant
+    double ms = 0.0;
+    long allocs = 0;         // nodes constructed (MemStats::total)
+};
+
+/* Checks of one feature each, on a numbered term a that
+ * checked with type t.  Each returns a description of the
+ * invariants it found broken, or "".
+ */
+struct FeatureCheck {
+    const char *name;
+    std::string (*run)(AstP a, AstP t);
+};
+
+// Wind a, evaluate it at once, and print the result.
+static std::string eval_print(AstP a) {
+    ErrorList err;
+    Stack *s = new Stack(err, nullptr, a, false);
+    eval_need(s);
+    std::ostringstream os;
+    print_stack(os, s);
+    stack_dtor(s);
+    return os.str();
+}
+
+// get_ast of a fresh wind round-trips.
+static std::string check_unwind(AstP a, AstP) {
+    std::ostringstream fail;
+    ErrorList err;
+    Stack *s = new Stack(err, nullptr, a, false);
+    AstP a1 = get_ast(s);
+    Stack *s2 = new Stack(err, nullptr, a1, false);
+    AstP a2 = get_ast(s2);
+    if(!err.ok() || !same_ast(a1, a2)) {
+        fail << "Re-winding get_ast does not round-trip:\n  "
+             << a1 << "\n  " << a2 << "\n" << err;
+    }
+    stack_dtor(s2);
+    stack_dtor(s);
+    return fail.str();
+}
+
+// Evaluation preserves typing (the type may only narrow).
+static std::string check_eval(AstP a, AstP t) {
+    std::ostringstream fail;
+    ErrorList err;
+    Stack *s = new Stack(err, nullptr, a, false);
+    eval_need(s);
+    AstP t1 = get_type(err, s);
+    if(!err.ok() || subType(t1, t)) {
+        fail << "Type changed by eval_need: " << t << "\n  became "
+             << t1 << "\n" << err;
+    }
+    stack_dtor(s);
+    return fail.str();
+}
+
+// Dropping unused lets does not change the type.
+static std::string check_drop_dead(AstP a, AstP t) {
+    std::ostringstream fail;
+    ErrorList err;
+    Stack *s = new Stack(err, nullptr, drop_dead_lets(a), false);
+    AstP t1 = err.ok() ? get_type(err, s) : nullptr;
+    if(!err.ok() || !same_type(t, t1)) {
+        fail << "drop_dead_lets changed the type " << t << "\n  to ";
+        if(t1) fail << t1;
+        fail << "\n" << err;
+    }
+    stack_dtor(s);
+    return fail.str();
+}
+
+// Printing the stack directly matches printing get_ast.
+static std::string check_print(AstP a, AstP) {
+    std::ostringstream fail;
+    ErrorList err;
+    Stack *s = new Stack(err, nullptr, a, false);
+    std::ostringstream p1, p2;
+    p1 << get_ast(s);
+    print_stack(p2, s);
+    if(p1.str() != p2.str()) {
+        fail << "print_stack differs from print_ast:\n  "
+             << p2.str() << "\n  " << p1.str() << "\n";
+    }
+    // A size limit cuts the output short, with "...".
+    for(long n : {0, 1, 2, 5, 20}) {
+        PrintLimits lim;
+        lim.max_size = n;
+        std::ostringstream p3;
+        print_stack(p3, s, lim);
+        std::string cut = p3.str();
+        size_t k = cut.size() >= 3 ? cut.size() - 3 : 0;
+        if(cut != p2.str() && (cut.compare(k, 3, "...") != 0
+                               || p2.str().compare(0, k, cut, 0, k) != 0)) {
+            fail << "print_stack of " << n << " nodes is not a prefix:\n  "
+                 << cut << "\n  " << p2.str() << "\n";
+        }
+    }
+    stack_dtor(s);
+    return fail.str();
+}
+
+// Evaluating one step at a time, resuming until done, gives
+// the same result as evaluating at once.
+static std::string check_resume(AstP a, AstP) {
+    std::ostringstream fail;
+    ErrorList err;
+    Stack *s = new Stack(err, nullptr, a, false);
+    for(int i=0; i<100000; ++i) {
+        Fuel f(1);
+        FuelScope scope(f);
+        if(eval_need(s)) break;
+    }
+    std::ostringstream e1;
+    print_stack(e1, s);
+    std::string e0 = eval_print(a);
+    if(e0 != e1.str()) {
+        fail << "Resumed eval_need differs:\n  " << e1.str()
+             << "\n  " << e0 << "\n";
+    }
+    stack_dtor(s);
+    return fail.str();
+}
+
+// With a little fuel, checking either gives the same type or
+// stops with the fuel used up, releasing its nodes.
+static std::string check_fuel(AstP a, AstP t) {
+    std::ostringstream fail;
+    long live = MemStats::leaked();
+    {
+        ErrorList E;
+        Fuel fuel(50);
+        FuelScope scope(fuel);
+        Stack *s = new Stack(E, nullptr, a, false);
+        AstP t1 = E.ok() ? get_type(E, s) : nullptr;
+        if(E.ok() ? !same_ast(t, t1) : !fuel.empty()) {
+            fail << "Fuel budget gives type ";
+            if(t1) fail << t1;
+            fail << "\n  instead of " << t << "\n" << E;
+        }
+        stack_dtor(s);
+    }
+    if(MemStats::leaked() != live) {
+        fail << "Fuel budget leaked " << MemStats::leaked() - live
+             << " nodes\n";
+    }
+    return fail.str();
+}
+
+// Parallel evaluation, forking every closed argument, gives
+// the same result.
+static std::string check_parallel(AstP a, AstP) {
+    std::ostringstream fail;
+    static Pool pool(4);
+    ErrorList err;
+    Stack *s = new Stack(err, nullptr, a, false);
+    eval_need_parallel(s, pool, 1);
+    std::ostringstream e1;
+    print_stack(e1, s);
+    std::string e0 = eval_print(a);
+    if(e0 != e1.str()) {
+        fail << "Parallel eval_need differs:\n  " << e1.str()
+             << "\n  " << e0 << "\n";
+    }
+    stack_dtor(s);
+
+    // In slices of a little fuel, which the tasks spend as well.
+    s = new Stack(err, nullptr, a, false);
+    int slices = 0;
+    for(bool done = false; !done && slices < 100000; ++slices) {
+        Fuel fuel(3);
+        FuelScope scope(fuel);
+        done = eval_need_parallel(s, pool, 1);
+    }
+    std::ostringstream e2;
+    print_stack(e2, s);
+    if(e0 != e2.str()) {
+        fail << "Parallel eval_need in " << slices << " slices differs:\n  "
+             << e2.str() << "\n  " << e0 << "\n";
+    }
+    stack_dtor(s);
+    return fail.str();
+}
+
+// The erased term normalizes to the erased eval_need result.
+static std::string check_erase(AstP a, AstP) {
+    std::ostringstream fail;
+    ErrorList err;
+    Stack *s = new Stack(err, nullptr, a, false);
+    eval_need(s);
+    AstP n1 = erase(get_ast(s));
+    AstP n2 = normalize(erase(a));
+    if(!same_ast(n1, n2)) {
+        fail << "Erased normal form differs:\n  " << n2
+             << "\n  " << n1 << "\n";
+    }
+    stack_dtor(s);
+    return fail.str();
+}
+
+/* get_ast hits its cache until the stack, or one of its
+ * sub-stacks, is modified, and then gives the same Ast again.
+ * After eval_need, it gives the evaluated stack.
+ */
+static std::string check_ast_cache(AstP a, AstP) {
+    std::ostringstream fail;
+    ErrorList err;
+    Stack *s = new Stack(err, nullptr, a, false);
+    AstP a1 = get_ast(s);
+    if(get_ast(s) != a1) {
+        fail << "get_ast of an unchanged stack missed its cache\n";
+    }
+    // get_type only winds scratch stacks (GetType::instantiate).
+    get_type(err, s);
+    if(get_ast(s) != a1) {
+        fail << "get_ast missed its cache after get_type\n";
+    }
+    for(Stack *sub : {s->app, s}) {
+        if(sub == nullptr) continue;
+        sub->modified();
+        AstP a2 = get_ast(s);
+        if(a2 == a1) {
+            fail << "get_ast hit its cache after "
+                 << (sub == s ? "modified()\n" : "a sub-stack's modified()\n");
+        } else if(!same_ast(a1, a2)) {
+            fail << "get_ast changed without a change to the stack:\n  "
+                 << a1 << "\n  " << a2 << "\n";
+        }
+        a1 = a2;
+    }
+
+    eval_need(s);
+    std::ostringstream e0, e1;
+    e0 << get_ast(s);
+    print_stack(e1, s);
+    if(e0.str() != e1.str()) {
+        fail << "Stale get_ast after eval_need:\n  " << e0.str()
+             << "\n  " << e1.str() << "\n";
+    }
+    stack_dtor(s);
+    return fail.str();
+}
+
+// The instantiation cache does not change the type.
+static std::string check_inst_cache(AstP a, AstP t) {
+    std::ostringstream fail;
+    ErrorList err;
+    InstStats::enabled = false;
+    Stack *s = new Stack(err, nullptr, a, false);
+    AstP t1 = err.ok() ? get_type(err, s) : nullptr;
+    InstStats::enabled = true;
+    if(!err.ok() || !same_ast(t, t1)) {
+        fail << "Uncached instantiation gives type ";
+        if(t1) fail << t1;
+        fail << "\n  instead of " << t << "\n" << err;
+    }
+    stack_dtor(s);
+    return fail.str();
+}
+
+// Under a small memory budget, checking either gives the same
+// type or fails cleanly, releasing its nodes.
+static std::string check_mem_budget(AstP a, AstP t) {
+    std::ostringstream fail;
+    long live = MemStats::leaked();
+    {
+        ErrorList E;
+        Stack *s8 = new Stack(E, nullptr, a, false); // not charged
+        MemBudget budget(2048);
+        MemBudgetScope scope(budget);
+        Stack *s = new Stack(E, nullptr, a, false);
+        AstP t1 = E.ok() ? get_type(E, s) : nullptr;
+        bool oom = budget.exceeded;
+        stack_dtor(s);
+        // Freeing nodes charged elsewhere refunds nothing.
+        long used = budget.used;
+        stack_dtor(s8);
+        if(budget.used != used) {
+            fail << "Memory budget refunded " << used - budget.used
+                 << " bytes it was not charged\n";
+        }
+        if(!oom && (!E.ok() || !same_ast(t, t1))) {
+            fail << "Memory budget gives type ";
+            if(t1) fail << t1;
+            fail << "\n  instead of " << t << "\n" << E;
+        }
+    }
+    if(MemStats::leaked() != live) {
+        fail << "Memory budget leaked " << MemStats::leaked() - live
+             << " nodes\n";
+    }
+    return fail.str();
+}
+
+static const FeatureCheck feature_checks[] = {
+    {"unwind", check_unwind},
+    {"eval", check_eval},
+    {"drop_dead", check_drop_dead},
+    {"print", check_print},
+    {"resume", check_resume},
+    {"fuel", check_fuel},
+    {"parallel", check_parallel},
+    {"erase", check_erase},
+    {"ast_cache", check_ast_cache},
+    {"inst_cache", check_inst_cache},
+    {"mem_budget", check_mem_budget},
+};
+
+// Run every feature check, reporting exceptions as failures.
+static std::string run_feature_checks(AstP a, AstP t) {
+    std::string fail;
+    for(const FeatureCheck &check : feature_checks) {
+        try {
+            fail += check.run(a, t);
+        } catch(std::exception &e) {
+            fail += std::string("Check ") + check.name + " threw: "
+                  + e.what() + "\n";
+        }
+    }
+    return fail;
+}
+
+/** Run the checker pipeline on one named term.
+ *  If `type` is non-null, the synthesized type is compared to it.
+ *  Only numbering, winding and get_type are timed and counted;
+ *  the feature checks that follow are not.
+ */
+static CheckResult check_term(AstP named, AstP type) {
+    CheckResult r;
+    long alloc0 = MemStats::total();
+    auto t0 = std::chrono::steady_clock::now();
+    size_t names0 = Name::count();
+    std::stringstream fail;
+
+    ErrorList err;
+    AstP a = named;
+    Stack *s = nullptr;
+    AstP t;
+    bool threw = false;
+    try {
+        numberAst(err, &a);
+        s = err.ok() ? new Stack(err, nullptr, a, false) : nullptr;
+        t = err.ok() ? get_type(err, s) : nullptr;
+    } catch(std::exception &e) {
+        r.failure = std::string("Checker threw: ") + e.what() + "\n";
+        threw = true;
+    }
+    std::chrono::duration<double, std::milli> dt =
+                    std::chrono::steady_clock::now() - t0;
+    r.ms = dt.count();
+    r.allocs = MemStats::total() - alloc0;
+    if(threw) return r; // s is not in a consistent state
+
+    if(s) stack_dtor(s);
+    if(!err.ok()) {
+        fail << err;
+    } else {
+        r.well_typed = true;
+        if(type) {
+            numberAst(err, &type);
+            if(!same_type(t, type)) {
+                fail << "Synthesized type " << t
+                     << "\n  differs from generated type " << type << "\n";
+            }
+        }
+        fail << run_feature_checks(a, t);
+    }
+    // Interned names are released with their last binder.
+    if(Name::count() != names0) {
+        fail << "Interned names leaked: " << Name::count() - names0 << "\n";
+    }
+    r.failure = fail.str();
+    return r;
+}
+
+/** Shrink a slow term by replacing sub-trees with their children,
+ *  keeping only candidates that are still well-typed and slow.
+ */
+static AstP minimize(AstP a, double slow_ms) {
+    std::function<bool(AstP, std::function<bool(AstP)>)> shrink;
+    // Try each one-step shrink of a (rebuilt through `wrap`)
+    // until one is accepted.
+    shrink = [&](AstP x, std::function<bool(AstP)> wrap) -> bool {
+        int n = getNChild(x->t);
+        for(int i=0; i<n; ++i) { // replace x by a child of the same sort
+            if(isType(x->t) == isType(x->child[i]->t)
+                    && wrap(x->child[i])) return true;
+        }
+        for(int i=0; i<n; ++i) {
+            auto sub = [&, i](AstP c) {
+                AstP y = std::make_shared<Ast>(x->t, x->name,
+                                               x->child[0], x->child[1]);
+                y->child[i] = c;
+                return wrap(y);
+            };
+            if(shrink(x->child[i], sub)) return true;
+        }
+        return false;
+    };
+    bool progress = true;
+    while(progress) {
+        progress = shrink(a, [&](AstP cand) {
+            CheckResult r = check_term(cand, nullptr);
+            if(r.well_typed && r.failure.size() == 0 && r.ms >= slow_ms) {
+                a = cand;
+                return true;
+            }
+            return false;
+        });
+    }
+    return a;
+}
+
+/** Check each entry of a module, independently, or as in
+ *  check_group if env is given (and then save them, if given).
+ *  Returns the errors, or "" if every entry checked.
+ */
+static std::string check_text(const std::string &text, TopEnv *env = nullptr,
+                              ImageWriter *save = nullptr) {
+    ErrorList err;
+    AstP g = parse_module(err, text, "test");
+    for(; err.ok() && (g->t == Type::group || g->t == Type::Group);
+                      g = g->child[1]) {
+        bool isT = g->t == Type::Group;
+        AstP a = g->child[0];
+        numberAst(err, &a, nullptr, env);
+        if(!err.ok()) break;
+        Stack *s = new Stack(err, nullptr, a, isT);
+        AstP t = err.ok() ? get_type(err, s) : nullptr;
+        if(env && err.ok()) {
+            const Bind *def = env->define(g->name, isT, s, t);
+            if(save) save->add(g->name, isT, a, t, "", def);
+        } else {
+            stack_dtor(s);
+        }
+    }
+    std::ostringstream os;
+    if(!err.ok()) os << err;
+    return os.str();
+}
+
+/* Type arguments are checked against their bound directly
+ * (Bind::check_rhs).  Their get_type is Top, which is only a
+ * subtype of a Top bound.
+ */
+static std::string test_type_args() {
+    std::string fail;
+    std::string errs = check_text(
+            "a = (fn(X<:All(A<:Top) A -> A) top)(:All(A<:Top) A -> A);\n"
+            "b = (fn(X<:Top -> Top) top)(:Top -> Top);\n");
+    if(errs.size()) {
+        fail += "Type argument within its bound rejected:\n" + errs;
+    }
+    if(check_text("c = (fn(X<:Top -> Top) top)(:Top);\n").empty()) {
+        fail += "Type argument outside its bound accepted.\n";
+    }
+    return fail;
+}
+
+/* Every prelude entry checks with get_type, to the type written
+ * here, except the ill-typed examples err1..err3, which must fail.
+ */
+static std::string test_prelude_types() {
+    static const std::map<std::string, std::string> expected = {
+        {"Id", "Top"}, {"Bool", "Top"}, {"True", "Top"}, {"False", "Top"},
+        {"id", "All(X<:Top) X -> X"}, {"id2", "All(X<:Top) X -> X"},
+        {"id1x", "All(X<:Top) X -> X"}, {"id2x", "All(X<:Top) X -> X"},
+        {"twice", "All(A<:Top) (A -> A) -> A -> A"},
+        {"once", "All(A<:Top) (A -> A) -> A -> A"},
+        {"true", "All(X<:Top) X -> X -> X"},
+        {"false", "All(X<:Top) X -> X -> X"},
+        {"tt", "All(X<:Top) X -> Top -> X"},
+        {"ff", "All(X<:Top) Top -> X -> X"},
+        {"cond", "All(X<:Top) (All(Y<:Top) Y -> Y -> Y) -> X -> X -> X"},
+        {"pair", "All(A<:Top) All(B<:Top) A -> B ->"
+                 " All(C<:Top) (A -> B -> C) -> C"},
+        {"fst", "All(A<:Top) All(B<:Top)"
+                " (All(C<:Top) (A -> B -> C) -> C) -> A"},
+        {"snd", "All(A<:Top) All(B<:Top)"
+                " (All(C<:Top) (A -> B -> C) -> C) -> B"},
+    };
+    std::ostringstream fail;
+    size_t found = 0;
+    for(AstP g = prelude(); g->t == Type::group || g->t == Type::Group;
+                            g = g->child[1]) {
+        bool ill = g->name == "err1" || g->name == "err2"
+                || g->name == "err3";
+        ErrorList err;
+        Stack *s = new Stack(err, nullptr, g->child[0], g->t == Type::Group);
+        AstP t = err.ok() ? get_type(err, s) : nullptr;
+        stack_dtor(s);
+        if(ill) {
+            if(err.ok()) fail << g->name << " checks, but is ill-typed\n";
+            continue;
+        }
+        if(!err.ok()) {
+            fail << g->name << " does not check\n" << err;
+            continue;
+        }
+        auto it = expected.find(g->name);
+        if(it == expected.end()) {
+            fail << g->name << " has no expected type\n";
+            continue;
+        }
+        ++found;
+        AstP m = parse_module(err, "T =: " + it->second + ";", "test");
+        AstP want = err.ok() ? m->child[0] : nullptr;
+        if(want) numberAst(err, &want);
+        if(!err.ok() || !same_ast(t, want)) {
+            fail << g->name << " checks as " << t
+                 << "\n  expected " << it->second << "\n" << err;
+        }
+    }
+    if(found != expected.size()) {
+        fail << "Only " << found << " of " << expected.size()
+             << " expected prelude entries checked\n";
+    }
+    return fail.str();
+}
+
+/* An exception thrown by a pool task is rethrown by wait, once
+ * every task of its group is done, and the pool stays usable.
+ */
+static std::string test_pool_errors() {
+    std::ostringstream fail;
+    Pool pool(4);
+    TaskGroup g;
+    std::atomic<int> ran{0};
+    for(int i=0; i<16; ++i) {
+        pool.spawn(g, [i, &ran]() {
+            ++ran;
+            if(i % 5 == 0) throw std::runtime_error("task failed");
+        });
+    }
+    bool thrown = false;
+    try {
+        pool.wait(g);
+    } catch(const std::runtime_error &) {
+        thrown = true;
+    }
+    if(!thrown) fail << "Task exception not rethrown by wait\n";
+    if(g.pending != 0 || ran != 16) {
+        fail << "Wait returned with " << g.pending << " tasks pending, "
+             << ran << " of 16 run\n";
+    }
+    pool.spawn(g, [&ran]() { ++ran; });
+    try {
+        pool.wait(g);
+    } catch(const std::runtime_error &) {
+        fail << "Exception rethrown twice\n";
+    }
+    if(ran != 17) fail << "Pool unusable after a task exception\n";
+    return fail.str();
+}
+
+/* A server round trip on a temporary socket, with a handler that
+ * echoes the request: load_test over several connections, a frame
+ * arriving in pieces while another connection is served, and bad
+ * frames (too long, or empty), which close their connection only.
+ */
+// Connect, so that a broken server fails reads instead of hanging.
+static int test_connect(const std::string &path) {
+    int fd = connect_server(path);
+    struct timeval tv = {5, 0};
+    if(fd >= 0) setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+static std::string test_server() {
+    std::ostringstream fail, log;
+    std::string path = "/tmp/fsub-test-" + std::to_string(getpid())
+                     + ".sock";
+    int served = -1;
+    std::thread server([&]() {
+        served = serve(log, path, [](char op, const std::string &text) {
+            return (op == 'c' ? "0" : "1") + text;
+        });
+    });
+    int fd = -1;
+    for(int i=0; i<200 && fd < 0; ++i) {
+        fd = test_connect(path);
+        if(fd < 0) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    if(fd < 0) {
+        server.detach(); // cannot stop it
+        return "Cannot connect to the test server\n";
+    }
+    std::ostringstream load;
+    if(load_test(load, path, 'c', "x = top;", 40, 4) != 0) {
+        fail << "Load test failed:\n" << load.str();
+    }
+
+    // A frame in two pieces, with a whole one in between.
+    int slow = test_connect(path);
+    std::string frame = "cslow", resp;
+    uint32_t len = htonl(frame.size());
+    std::string head((const char *)&len, sizeof(len));
+    if(write(slow, (head + "cs").data(), head.size() + 2) < 0
+            || !request(fd, 'c', "fast", resp)
+            || resp.compare(0, 5, "0fast") != 0) {
+        fail << "Request held up by a partial frame: " << resp << "\n";
+    }
+    if(write(slow, "low", 3) != 3 || !read_frame(slow, resp)
+            || resp.compare(0, 5, "0slow") != 0) {
+        fail << "Frame sent in pieces answered with: " << resp << "\n";
+    }
+    if(!request(fd, 'e', "", resp) || resp.compare(0, 1, "1") != 0) {
+        fail << "Failed request answered with: " << resp << "\n";
+    }
+
+    // Bad frames close their connection, and the server goes on.
+    for(uint32_t bad : {(uint32_t)max_frame + 1, 0u}) {
+        int c = test_connect(path);
+        len = htonl(bad);
+        char byte;
+        if(write(c, &len, sizeof(len)) != sizeof(len)
+                || recv(c, &byte, 1, 0) != 0) { // EOF, not a timeout
+            fail << "Frame of " << bad << " bytes did not close the"
+                 << " connection\n";
+        }
+        close(c);
+    }
+    if(!request(fd, 'c', "again", resp) || resp.compare(0, 6, "0again")) {
+        fail << "Server unusable after a bad frame\n";
+    }
+
+    close(slow);
+    if(!request(fd, 'q', "", resp) || resp.size() != 0) {
+        fail << "Stop request answered with: " << resp << "\n";
+    }
+    close(fd);
+    server.join();
+    if(served != 0) fail << "serve returned " << served << "\n";
+    if(fail.str().size()) fail << log.str();
+    return fail.str();
+}
+
+// Every feature check holds for the prelude's terms.
+static std::string test_prelude_features() {
+    std::ostringstream fail;
+    for(AstP g = prelude(); g->t == Type::group || g->t == Type::Group;
+                            g = g->child[1]) {
+        if(g->t == Type::Group) continue;
+        ErrorList err;
+        Stack *s = new Stack(err, nullptr, g->child[0], false);
+        AstP t = err.ok() ? get_type(err, s) : nullptr;
+        stack_dtor(s);
+        if(!err.ok()) continue; // the ill-typed examples
+        std::string f = run_feature_checks(g->child[0], t);
+        if(f.size()) fail << g->name << ": " << f;
+    }
+    return fail.str();
+}
+
+/* The instantiation cache keeps a bounded number of entries for
+ * a long-lived (TopEnv) binder, and drops them with it.
+ */
+static std::string test_inst_bound() {
+    std::ostringstream fail;
+    long base = InstStats::entries;
+    {
+        TopEnv env;
+        std::string text = "id = fn(X<:Top) fn(x:X) x;\nuse = ";
+        std::string type = "Top", close;
+        for(int i=0; i<200; ++i) { // 200 distinct closed type arguments
+            text += "(fn(u:Top) ";
+            close = ")(id(:" + type + "))" + close;
+            type = "Top -> " + type;
+        }
+        text += "top" + close + ";\n";
+        std::string errs = check_text(text, &env);
+        if(errs.size()) fail << "Instantiation test term rejected:\n" << errs;
+        long n = InstStats::entries - base;
+        if(n == 0 || n > 64) {
+            fail << "Instantiation cache holds " << n
+                 << " entries for one binder\n";
+        }
+    }
+    if(InstStats::entries != base) {
+        fail << "Instantiation cache kept " << InstStats::entries - base
+             << " entries of a deleted binder\n";
+    }
+    return fail.str();
+}
+
+/* Entries loaded from an image keep their references to each
+ * other, and modules are checked against them by name.
+ */
+static std::string test_image() {
+    std::string fail;
+    std::string fname = "/tmp/fsub-test-" + std::to_string(getpid()) + ".img";
+    ImageWriter writer;
+    {
+        TopEnv env;
+        fail += check_text("Id =: All(X<:Top) X -> X;\n"
+                           "id = fn(X<:Top) fn(x:X) x;\n"
+                           "id2 = id(:Id)(id);\n", &env, &writer);
+    }
+    if(!writer.write(fname)) return fname + ": cannot write\n";
+    try {
+        Image img(fname);
+        TopEnv lib(&img);
+        TopEnv env(&lib);
+        std::string errs = check_text("u = id2(:Id)(id2);\n", &env);
+        if(errs.size()) {
+            fail += "Entries of an image rejected:\n" + errs;
+        }
+        if(check_text("v = id2(id2);\n", &env).empty()) {
+            fail += "Missing type argument to an image entry accepted.\n";
+        }
+    } catch(std::runtime_error &e) {
+        fail += std::string(e.what()) + "\n";
+    }
+    remove(fname.c_str());
+    return fail;
+}
+
+/* print_dag prints each repeated sub-tree once, whether shared
+ * in memory or only structurally equal, and a tree without
+ * repeats as print_ast does.
+ */
+static std::string test_print_dag() {
+    std::ostringstream fail;
+    // T(k+1) = T(k) -> T(k), which is 2^k leaves as a tree.
+    AstP T = std::make_shared<Ast>(Type::Top);
+    for(int k=0; k<30; ++k) T = std::make_shared<Ast>(Type::Fn, T, T);
+    std::ostringstream os;
+    print_dag(os, T);
+    std::string out = os.str();
+    size_t wheres = 0;
+    for(size_t i = out.find("where $"); i != std::string::npos;
+               i = out.find("where $", i+1)) {
+        ++wheres;
+    }
+    if(wheres != 29 || out.size() > 2000) {
+        fail << "Shared sub-trees printed " << wheres << " times (29 expected)"
+             << ", in " << out.size() << " bytes\n";
+    }
+
+    // Equal, but separate, sub-trees.
+    auto pair = [] {
+        return std::make_shared<Ast>(Type::Fn, std::make_shared<Ast>(Type::Top),
+                                     std::make_shared<Ast>(Type::Top));
+    };
+    std::ostringstream eq;
+    print_dag(eq, std::make_shared<Ast>(Type::Fn, pair(), pair()));
+    if(eq.str() != "($1) ->$1\n  where $1 = (Top) ->Top") {
+        fail << "Equal sub-trees not printed once:\n" << eq.str() << "\n";
+    }
+
+    for(AstP g = prelude(); g->t == Type::group || g->t == Type::Group;
+                            g = g->child[1]) {
+        std::ostringstream dag, tree;
+        print_dag(dag, g->child[0]);
+        print_ast(tree, g->child[0]);
+        if(dag.str().find("where $") == std::string::npos
+                && dag.str() != tree.str()) {
+            fail << g->name << " printed as a DAG differs:\n  " << dag.str()
+                 << "\n  " << tree.str() << "\n";
+        }
+    }
+    return fail.str();
+}
+
+/* Make every variable of a pointing outside it (below depth
+ * binders) a pointer variable, keyed 0x1000 + 16*k for the k-th
+ * binder outside a, so that closing it again (with the map from
+ * each key to k) gives back a.
+ */
+static AstP open_vars(AstP a, int depth) {
+    if((a->t == Type::Var || a->t == Type::var) && !a->isPtr
+            && a->n >= depth) {
+        AstP y = std::make_shared<Ast>(a->t, a->name);
+        y->isPtr = true;
+        y->n = 0x1000 + 16*(a->n - depth);
+        return y;
+    }
+    if(getNChild(a->t) == 0) return a;
+    AstP c1 = a->child[1];
+    if(c1) c1 = open_vars(c1, isBind(a->t) ? depth+1 : depth);
+    return std::make_shared<Ast>(a->t, a->name, open_vars(a->child[0], depth),
+                                 c1);
+}
+
+/* The flat.hpp kernels give the same results as the tree walks
+ * they replace (shift and replaceVars), on the bodies of random
+ * terms and of the prelude, under up to four of their binders.
+ */
+static std::string test_flat() {
+    std::ostringstream fail;
+    std::vector<AstP> terms;
+    for(AstP g = prelude(); g->t == Type::group || g->t == Type::Group;
+                            g = g->child[1]) {
+        terms.push_back(g->child[0]);
+    }
+    GenOptions opt;
+    for(unsigned seed=1; seed<=50; ++seed) {
+        AstP type, a = gen_term(opt, seed, &type);
+        ErrorList err;
+        numberAst(err, &a);
+        if(err.ok()) terms.push_back(a);
+    }
+    std::map<intptr_t,int> map;
+    for(int k=0; k<4; ++k) map[0x1000 + 16*k] = k;
+
+    for(AstP a : terms) {
+        int k = 0; // binders stripped
+        for(; k < 4 && isBind(a->t); ++k) a = a->child[1];
+        if(!same_ast(unflatten(flatten(a)), a)) {
+            fail << "Flattening changed " << a << "\n";
+        }
+        for(int d : {1, 3}) {
+            for(int cutoff : {0, 1, 2}) {
+                FlatAst f = flatten(a);
+                flat_shift(f, d, cutoff);
+                AstP tree = shift(a, d, cutoff), flat = unflatten(f);
+                if(!same_ast(tree, flat)) {
+                    fail << "flat_shift by " << d << " above " << cutoff
+                         << " differs:\n  " << flat << "\n  " << tree << "\n";
+                }
+            }
+        }
+        AstP open = open_vars(a, 0);
+        FlatAst f = flatten(open);
+        flat_close(f, map, 0);
+        AstP tree = replaceVars(open, map, 0), flat = unflatten(f);
+        if(!same_ast(tree, a) || !same_ast(flat, a)) {
+            fail << "flat_close differs:\n  " << flat << "\n  " << tree
+                 << "\n  " << a << "\n";
+        }
+    }
+    return fail.str();
+}
+
+/* A JSON value, as read by JsonReader (enough of JSON for the
+ * trace files: no unicode escapes).
+ */
+struct Json {
+    char kind = 0; // one of "{[s0ntf" (number is '0')
+    std::string str;
+    double num = 0;
+    std::vector<std::pair<std::string, Json>> obj;
+    std::vector<Json> arr;
+
+    const Json *get(const std::string &key) const {
+        for(auto &kv : obj) if(kv.first == key) return &kv.second;
+        return nullptr;
+    }
+};
+
+// Recursive descent reader.  Throws std::runtime_error if malformed.
+struct JsonReader {
+    const std::string &s;
+    size_t i = 0;
+
+    JsonReader(const std::string &_s) : s(_s) {}
+
+    void ws() { while(i < s.size() && isspace((unsigned char)s[i])) ++i; }
+    void fail(const char *what) {
+        throw std::runtime_error(std::string(what) + " at byte "
+                                 + std::to_string(i));
+    }
+    void expect(char c) {
+        ws();
+        if(i >= s.size() || s[i] != c) fail("Expected a different token");
+        ++i;
+    }
+    std::string string() {
+        expect('"');
+        std::string out;
+        while(i < s.size() && s[i] != '"') {
+            if((unsigned char)s[i] < 0x20) fail("Control character in string");
+            if(s[i] == '\\') {
+                if(++i >= s.size() || !strchr("\"\\/bfnrt", s[i])) {
+                    fail("Bad escape");
+                }
+            }
+            out += s[i++];
+        }
+        expect('"');
+        return out;
+    }
+    Json value() {
+        Json v;
+        ws();
+        if(i >= s.size()) fail("Unexpected end");
+        v.kind = s[i];
+        if(s[i] == '{') {
+            ++i; ws();
+            if(s[i] == '}') { ++i; return v; }
+            do {
+                std::string k = string();
+                expect(':');
+                v.obj.emplace_back(k, value());
+                ws();
+            } while(i < s.size() && s[i] == ',' && ++i);
+            expect('}');
+        } else if(s[i] == '[') {
+            ++i; ws();
+            if(s[i] == ']') { ++i; return v; }
+            do {
+                v.arr.push_back(value());
+                ws();
+            } while(i < s.size() && s[i] == ',' && ++i);
+            expect(']');
+        } else if(s[i] == '"') {
+            v.kind = 's';
+            v.str = string();
+        } else if(s[i] == '-' || isdigit((unsigned char)s[i])) {
+            v.kind = '0';
+            char *end;
+            v.num = strtod(s.c_str() + i, &end);
+            i = end - s.c_str();
+        } else {
+            for(const char *w : {"true", "false", "null"}) {
+                if(s.compare(i, strlen(w), w) == 0) {
+                    i += strlen(w);
+                    return v;
+                }
+            }
+            fail("Unexpected character");
+        }
+        return v;
+    }
+    Json document() {
+        Json v = value();
+        ws();
+        if(i != s.size()) fail("Trailing characters");
+        return v;
+    }
+};
+
+/* Trace checking the prelude.  The trace is valid JSON, its
+ * begin and end events nest with increasing timestamps, and a
+ * mark's name is escaped.
+ */
+static std::string trace_prelude() {
+    std::ostringstream fail;
+    std::string fname = "/tmp/fsub-test-" + std::to_string(getpid())
+                      + ".json";
+    if(!Trace::open(fname.c_str())) return fname + ": cannot write\n";
+    const std::string mark = "a \"quoted\" \\name\t";
+    Trace::mark(mark);
+    for(AstP g = prelude(); g->t == Type::group || g->t == Type::Group;
+                            g = g->child[1]) {
+        ErrorList err;
+        Stack *s = new Stack(err, nullptr, g->child[0], g->t == Type::Group);
+        if(err.ok()) get_type(err, s);
+        stack_dtor(s);
+    }
+    Trace::close();
+    std::ifstream in(fname);
+    std::stringstream text;
+    text << in.rdbuf();
+    remove(fname.c_str());
+
+    try {
+        Json doc = JsonReader(text.str()).document();
+        const Json *events = doc.get("traceEvents");
+        if(!events || events->kind != '[') {
+            return "Trace has no traceEvents array\n";
+        }
+        std::vector<std::string> open;
+        double ts = 0;
+        long spans = 0;
+        for(const Json &e : events->arr) {
+            const Json *name = e.get("name"), *ph = e.get("ph"),
+                       *t = e.get("ts");
+            if(!name || !ph || !t || t->num < ts) {
+                fail << "Bad event " << spans << "\n";
+                break;
+            }
+            ts = t->num;
+            if(ph->str == "B") {
+                const Json *args = e.get("args");
+                const Json *depth = args ? args->get("depth") : nullptr;
+                if(!depth || depth->num != open.size()) {
+                    fail << "Begin of " << name->str << " at the wrong depth\n";
+                }
+                open.push_back(name->str);
+                ++spans;
+            } else if(ph->str == "E") {
+                if(open.empty() || open.back() != name->str) {
+                    fail << "End of " << name->str << " does not nest\n";
+                    break;
+                }
+                open.pop_back();
+            } else if(ph->str == "i" && name->str != "a \"quoted\" \\name?") {
+                fail << "Mark named " << name->str << "\n";
+            }
+        }
+        if(open.size()) fail << open.size() << " spans not ended\n";
+#ifdef FSUB_PROFILE
+        if(spans == 0) fail << "No spans traced\n";
+#endif
+    } catch(std::runtime_error &e) {
+        fail << "Trace is not valid JSON: " << e.what() << "\n";
+    }
+    return fail.str();
+}
+
+// A trace, and a second one written after it.
+static std::string test_trace() {
+    std::string fail = trace_prelude();
+    if(fail.empty()) fail = trace_prelude();
+    return fail;
+}
+
+/* print_stack elides Stacks nested deeper than max_depth, and
+ * stops after max_size Stacks and binders, however big the stack.
+ */
+static std::string test_print_limits() {
+    std::ostringstream fail;
+    std::string deep = "x";
+    for(int i=0; i<2000; ++i) deep = "f(" + deep + ")";
+    const std::string text =
+        "a = fn(x:Top) fn(f:Top->Top) f(f(f(x)));\n"
+        "b = fn(x:Top) fn(f:Top->Top) " + deep + ";\n";
+    struct { const char *entry; int depth; long size; const char *out; }
+    cases[] = {
+        {"a", -1, -1, "fn(:Top) -> fn(:(Top) ->Top) -> (0) (0) (0) 1"},
+        {"a", 1, -1, "fn(:...) -> fn(:...) -> (0) ..."},
+        {"a", 2, -1, "fn(:Top) -> fn(:(...) ->Top) -> (0) (0) ..."},
+        {"a", -1, 3, "fn(:Top) -> fn(:(..."},
+        {"a", -1, 0, "..."},
+        {"b", 3, -1, "fn(:Top) -> fn(:(Top) ->Top) -> (0) (0) (0) ..."},
+        {"b", -1, 4, "fn(:Top) -> fn(:(Top) ->Top) -> (0) ..."},
+    };
+    ErrorList err;
+    std::map<std::string, Stack *> stacks;
+    for(AstP g = parse_module(err, text, "test");
+            err.ok() && g->t == Type::group; g = g->child[1]) {
+        AstP a = g->child[0];
+        numberAst(err, &a);
+        if(err.ok()) stacks[g->name] = new Stack(err, nullptr, a, false);
+    }
+    if(!err.ok()) {
+        fail << "Cannot wind the test terms:\n" << err;
+        return fail.str();
+    }
+    for(auto &c : cases) {
+        PrintLimits lim;
+        lim.max_depth = c.depth;
+        lim.max_size = c.size;
+        std::ostringstream os;
+        print_stack(os, stacks[c.entry], lim);
+        if(os.str() != c.out) {
+            fail << c.entry << " printed to depth " << c.depth << " and size "
+                 << c.size << " as:\n  " << os.str() << "\n  expected "
+                 << c.out << "\n";
+        }
+    }
+    for(auto &p : stacks) stack_dtor(p.second);
+    return fail.str();
+}
+
+/* parse_module reports the first syntax error only, with its
+ * line, and returns no entries.
+ */
+static std::string test_parse_errors() {
+    std::ostringstream fail;
+    struct { const char *text, *error; } cases[] = {
+        {"a = fn(x:Top x;", "test:1: Expected ')'."},
+        {"a = top;\n\n# b = ;\nb = ;", "test:4: Expected an identifier."},
+        {"a top;", "test:1: Expected '='."},
+        {"A =: fn(x:Top) x;", "test:1: Expected ';' after definition."},
+        {"a = top;\nb = (top;\nc = (;", "test:2: Expected ')'."},
+        {"a = top;\nb = top", ""}, // the last ';' is optional
+    };
+    for(auto &c : cases) {
+        ErrorList err;
+        AstP g = parse_module(err, c.text, "test");
+        std::ostringstream os;
+        os << err;
+        if(*c.error == 0) {
+            if(!err.ok() || !g || g->t != Type::group) {
+                fail << "Rejected " << c.text << "\n" << os.str();
+            }
+        } else if(g || err.errors.size() != 1
+                    || os.str().find(c.error) == std::string::npos) {
+            fail << "Parsing " << c.text << "\n  gave " << os.str()
+                 << "  expected " << c.error << "\n";
+        }
+    }
+    return fail.str();
+}
+
+/* A type argument is bound in place (Bind::borrowed) when a
+ * polymorphic type is instantiated, as in GetType::instantiate.
+ * The result is unwound relative to the arguments' parent, and
+ * unwinding it relative to any other parent throws.
+ */
+static std::string test_borrowed_arg() {
+    std::ostringstream fail;
+    ErrorList err;
+    AstP g = parse_module(err, "a = fn(f:All(X<:Top) X -> X) f(:Top);\n"
+                               "T =: All(X<:Top) X -> X;\n", "test");
+    AstP a = g ? g->child[0] : nullptr, T = g ? g->child[1]->child[0] : nullptr;
+    if(a) numberAst(err, &a);
+    if(T) numberAst(err, &T);
+    if(!err.ok()) {
+        fail << "Cannot number the test term:\n" << err;
+        return fail.str();
+    }
+    Stack *s = new Stack(err, nullptr, a, false); // f(:Top), below f
+    Stack *ret = new Stack(s);
+    ret->detached = true;
+    ret->windType(err, T, s->app);
+    Bind *c = ret->ctxt;
+    while(c && !c->param) c = c->next;
+    if(!err.ok() || !c || !c->borrowed || c->rhs != s->app) {
+        fail << "Type argument not bound in place\n" << err;
+    } else {
+        try {
+            get_ast(ret, nullptr);
+            fail << "Borrowed type argument unwound outside its parent\n";
+        } catch(std::runtime_error &) {
+        }
+        eval_need(ret);
+        std::ostringstream os;
+        os << get_ast(ret);
+        if(os.str() != "(Top) ->Top") {
+            fail << "Instantiated as " << os.str() << "\n";
+        }
+    }
+    stack_dtor(ret);
+    stack_dtor(s);
+    return fail.str();
+}
+
+int random_check(const GenOptions &opt) {
+    int failed = 0, slow = 0;
+    double total_ms = 0.0;
+    long total_allocs = 0;
+    for(auto test : {test_type_args, test_prelude_types,
+                      test_prelude_features, test_inst_bound, test_image,
+                      test_pool_errors, test_server, test_print_dag,
+                      test_flat, test_trace, test_print_limits,
+                      test_parse_errors, test_borrowed_arg}) {
+        std::string fail = test();
+        if(fail.size()) {
+            ++failed;
+            std::cout << "FAILED\n" << fail << "\n";
+        }
+    }
+    for(int i=0; i<opt.count; ++i) {
+        unsigned seed = opt.seed + i;
+        AstP type;
+        AstP a = gen_term(opt, seed, &type);
+        if(opt.verbose) {
+            std::cout << "seed " << seed << ": ";
+            print_named(std::cout, a);
+            std::cout << std::endl;
+        }
+        CheckResult r = check_term(a, type);
+        total_ms += r.ms;
+        total_allocs += r.allocs;
+        if(opt.verbose) {
+            std::cout << "  " << r.ms << " ms, "
+                      << r.allocs << " allocs\n";
+        }
+        if(r.failure.size()) {
+            ++failed;
+            std::cout << "seed " << seed << " FAILED\n  ";
+            print_named(std::cout, a);
+            std::cout << "\n" << r.failure << "\n";
+            continue;
+        }
+        if(r.ms >= opt.slow_ms) {
+            ++slow;
+            AstP m = minimize(a, opt.slow_ms);
+            std::string fname = opt.save_dir + "/slow-"
+                              + std::to_string(seed) + ".fsub";
+            std::ofstream f(fname);
+            f << "# seed " << seed << ", " << r.ms << " ms, "
+              << r.allocs << " allocs before minimizing\n";
+            f << "slow = ";
+            print_named(f, m);
+            f << ";\n";
+            std::cout << "seed " << seed << " slow (" << r.ms
+                      << " ms), saved " << fname << "\n";
+        }
+    }
+    InstStats::print(std::cout);
+    std::cout << opt.count << " random terms, " << failed << " failed, "
+              << slow << " slow; " << total_ms << " ms, "
+              << total_allocs << " allocs\n";
+    return failed;
+}
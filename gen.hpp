@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+
+#include "ast.hpp"
+
+/** Settings for the random term generator and harness (gen.cpp).
+ */
+struct GenOptions {
+    unsigned seed = 1;
+    int count = 100;     ///< number of terms to generate
+    int size = 60;       ///< approximate node budget per term
+    int depth = 6;       ///< maximum nesting depth
+    double share = 0.2;  ///< probability of re-using an earlier sub-tree
+    double slow_ms = 100.0; ///< terms slower than this are minimized
+    std::string save_dir = "."; ///< where minimized slow terms are saved
+    bool verbose = false;
+};
+
+/** Generate a closed, well-typed term along with its type.
+ *  Both are named Ast-s (not yet numbered).
+ */
+AstP gen_term(const GenOptions &opt, unsigned seed, AstP *type);
+
+/** Print a named Ast in module-file syntax (see parse.cpp). */
+void print_named(std::ostream &os, AstP a);
+
+/** Generate opt.count terms and cross-check the checker on each.
+ *  Returns the number of terms that failed a check.
+ */
+int random_check(const GenOptions &opt);
@@ -0,0 +1,214 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+
+#include "image.hpp"
+
+uint32_t ImageWriter::str(const std::string &s) {
+    if(s.size() == 0) return 0;
+    auto it = strings.find(s);
+    if(it != strings.end()) return it->second;
+    uint32_t off = chars.size();
+    chars.append(s.c_str(), s.size()+1);
+    strings.emplace(s, off);
+    return off;
+}
+
+// Children are added before their parents, so that
+// loading never needs forward references.
+int32_t ImageWriter::add_ast(const AstP &a) {
+    if(a == nullptr) return -1;
+    auto it = index.find(a);
+    if(it != index.end()) return it->second;
+    image::Node x;
+    x.t = (uint8_t)a->t;
+    x.name = str(a->name);
+    x.child[0] = add_ast(a->child[0]);
+    x.child[1] = add_ast(a->child[1]);
+    x.n = a->n;
+    // References to earlier entries (TopEnv) are saved by position.
+    if(a->isPtr) {
+        auto def = defs.find((const Bind *)a->n);
+        if(def == defs.end()) {
+            throw std::runtime_error("Cannot save a reference to "
+                                     + a->name + " outside the image.");
+        }
+        x.n = -1 - def->second;
+    }
+    int32_t i = node.size();
+    node.push_back(x);
+    index.emplace(a, i);
+    return i;
+}
+
+void ImageWriter::add(const std::string &name, bool isT, AstP term,
+                      AstP type, const std::string &errors,
+                      const Bind *def) {
+    image::Entry e;
+    e.name = str(name);
+    e.isT = isT;
+    e.ok = type != nullptr;
+    e.term = add_ast(term);
+    e.type = add_ast(type);
+    e.errors = str(errors);
+    if(def) defs[def] = entry.size();
+    entry.push_back(e);
+}
+
+bool ImageWriter::write(const std::string &fname) const {
+    std::vector<uint32_t> ok;
+    for(uint32_t i=0; i<entry.size(); ++i) {
+        if(entry[i].ok) ok.push_back(i);
+    }
+    std::stable_sort(ok.begin(), ok.end(), [&](uint32_t i, uint32_t j) {
+        return strcmp(&chars[entry[i].name], &chars[entry[j].name]) < 0;
+    });
+    FILE *f = fopen(fname.c_str(), "wb");
+    if(f == nullptr) return false;
+    image::Header hdr;
+    memcpy(hdr.magic, image::magic, sizeof(hdr.magic));
+    hdr.nnode = node.size();
+    hdr.nentry = entry.size();
+    hdr.nchar = chars.size();
+    hdr.nindex = ok.size();
+    bool good = fwrite(&hdr, sizeof(hdr), 1, f) == 1
+           && fwrite(node.data(), sizeof(image::Node), node.size(), f)
+                    == node.size()
+           && fwrite(entry.data(), sizeof(image::Entry), entry.size(), f)
+                    == entry.size()
+           && fwrite(ok.data(), sizeof(uint32_t), ok.size(), f) == ok.size()
+           && fwrite(chars.data(), 1, chars.size(), f) == chars.size();
+    return fclose(f) == 0 && good;
+}
+
+Image::Image(const std::string &fname) {
+    int fd = open(fname.c_str(), O_RDONLY);
+    if(fd < 0) {
+        throw std::runtime_error(fname + ": cannot open");
+    }
+    struct stat st;
+    if(fstat(fd, &st) == 0) {
+        len = st.st_size;
+    }
+    if(len >= sizeof(image::Header)) {
+        base = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if(base == nullptr || base == MAP_FAILED) {
+        base = nullptr;
+        throw std::runtime_error(fname + ": not an image");
+    }
+
+    // Only the layout is checked here.  Nodes and entries are
+    // checked as they are used (see entry and ast).
+    auto bad = [&](const char *why) {
+        munmap(base, len);
+        base = nullptr;
+        return std::runtime_error(fname + ": " + why);
+    };
+    const char *p = (const char *)base;
+    hdr = (const image::Header *)p;
+    if(memcmp(hdr->magic, image::magic, sizeof(image::magic))) {
+        throw bad("not an image");
+    }
+    uint64_t need = sizeof(image::Header)
+                  + (uint64_t)hdr->nnode * sizeof(image::Node)
+                  + (uint64_t)hdr->nentry * sizeof(image::Entry)
+                  + (uint64_t)hdr->nindex * sizeof(uint32_t)
+                  + hdr->nchar;
+    if(need != len || hdr->nindex > hdr->nentry) {
+        throw bad("truncated image");
+    }
+    p += sizeof(image::Header);
+    nodes = (const image::Node *)p;
+    p += hdr->nnode * sizeof(image::Node);
+    entries = (const image::Entry *)p;
+    p += hdr->nentry * sizeof(image::Entry);
+    index = (const uint32_t *)p;
+    p += hdr->nindex * sizeof(uint32_t);
+    chars = p;
+    if(hdr->nchar == 0 || chars[hdr->nchar-1] != '\0') {
+        throw bad("truncated image");
+    }
+}
+
+Image::~Image() {
+    if(base) munmap(base, len);
+}
+
+const image::Entry &Image::entry(size_t i) const {
+    const image::Entry &e = entries[i];
+    if(e.name >= hdr->nchar || e.errors >= hdr->nchar
+            || e.term < 0 || (uint32_t)e.term >= hdr->nnode
+            || e.type < -1 || e.type >= (int32_t)hdr->nnode
+            || (e.type < 0) == (bool)e.ok) {
+        throw std::runtime_error("image: corrupt entry");
+    }
+    return e;
+}
+
+AstP Image::term(size_t i, const Resolve &resolve) {
+    return ast(entry(i).term, i, resolve);
+}
+
+AstP Image::type(size_t i, const Resolve &resolve) {
+    return ast(entry(i).type, i, resolve);
+}
+
+long Image::find(const std::string &name) const {
+    // The last entry named name, in the sorted index.
+    size_t lo = 0, hi = hdr->nindex;
+    while(lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if(index[mid] >= hdr->nentry) {
+            throw std::runtime_error("image: corrupt index");
+        }
+        if(name.compare(this->name(index[mid])) < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    if(lo == 0 || name != this->name(index[lo-1])) return -1;
+    return index[lo-1];
+}
+
+// Materialize node i of entry in.
+AstP Image::ast(int32_t i, size_t in, const Resolve &resolve) {
+    if(i < 0) return nullptr;
+    auto it = loaded.find(i);
+    if(it != loaded.end()) return it->second;
+    const image::Node &x = nodes[i];
+    if(x.t < (uint8_t)Type::Var || x.t > (uint8_t)Type::group
+            || x.name >= hdr->nchar) {
+        throw std::runtime_error("image: corrupt node");
+    }
+    AstP y = std::make_shared<Ast>((Type)x.t, chars + x.name);
+    y->n = x.n;
+    bool var = y->t == Type::Var || y->t == Type::var;
+    if(var && x.n < 0) { // a reference to entry k
+        uint64_t k = -1 - x.n;
+        Bind *ref = k < in ? resolve(k) : nullptr;
+        if(ref == nullptr) {
+            throw std::runtime_error("image: unresolved reference to "
+                                     + y->name);
+        }
+        y->isPtr = true;
+        y->n = (intptr_t)ref;
+    }
+    for(int j=0; j<2; ++j) {
+        // Children come first, which also rules out cycles.
+        bool need = j < getNChild(y->t);
+        if(need ? x.child[j] < 0 || x.child[j] >= i : x.child[j] != -1) {
+            throw std::runtime_error("image: corrupt node");
+        }
+        if(need) y->child[j] = ast(x.child[j], in, resolve);
+    }
+    loaded[i] = y;
+    return y;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.hpp"
+
+struct Bind;
+
+/** Snapshot images of a checked group chain.
+ *
+ *  An image holds the numbered terms of every entry along with
+ *  its check result and type, as a flat array of nodes that refer
+ *  to each other and to a string table by index.  It is therefore
+ *  relocatable, and is used in place after mmap-ing the file.
+ *
+ *  Stacks are not stored.  They hold pointers into the heap and are
+ *  cheap to re-wind from a numbered Ast, while the expensive part
+ *  (parsing, numbering and checking every entry) is what the image
+ *  saves.  A TopEnv over an image re-winds an entry only when a
+ *  name first refers to it, so loading costs the same whatever the
+ *  size of the image.
+ *
+ *  Nothing is read in advance: each node or entry is validated
+ *  when it is first used, and a malformed one throws
+ *  std::runtime_error.
+ */
+namespace image {
+
+static constexpr char magic[8] = {'F','S','U','B','I','M','G','2'};
+
+struct Header {
+    char magic[8];
+    uint32_t nnode;
+    uint32_t nentry;
+    uint32_t nchar;  // size of the string table
+    uint32_t nindex; // entries that checked, in the name index
+};
+
+struct Node {
+    uint8_t t;
+    uint8_t pad[3] = {0, 0, 0};
+    uint32_t name;     // offset into the string table
+    int32_t child[2];  // node indices, -1 if absent
+    int64_t n;         // de-Bruijn index, or -1-k for a reference
+                       // to the earlier entry k (named by name),
+                       // -1 if not a variable
+};
+
+struct Entry {
+    uint32_t name;
+    uint8_t isT;       // Group (true) or group (false)
+    uint8_t ok;        // checked without errors
+    uint8_t pad[2] = {0, 0};
+    int32_t term;      // numbered term
+    int32_t type;      // its type, -1 if it failed to check
+    uint32_t errors;   // error messages, if it failed
+};
+
+/* The file is a Header, nnode Node-s, nentry Entry-s, the
+ * name index, and nchar bytes of strings.  The name index holds
+ * the entries that checked, sorted by name and then by position,
+ * so that a name is found by binary search.
+ */
+
+} // namespace image
+
+/** Collects checked entries and writes them as an image. */
+struct ImageWriter {
+    std::vector<image::Node> node;
+    std::vector<image::Entry> entry;
+    std::string chars = std::string(1, '\0'); // offset 0 is ""
+
+    /** Add a checked entry.  type is null if it failed, and
+     *  def is the TopEnv Bind it became, if any.  Pointer variables
+     *  must refer to the def of an entry added before.
+     *  Throws std::runtime_error otherwise.
+     */
+    void add(const std::string &name, bool isT, AstP term, AstP type,
+             const std::string &errors = "", const Bind *def = nullptr);
+    // Returns false if the file could not be written.
+    bool write(const std::string &fname) const;
+
+  private:
+    // Holds on to saved Ast-s, so their addresses are not re-used.
+    std::unordered_map<AstP, int32_t> index;
+    std::unordered_map<std::string, uint32_t> strings;
+    std::unordered_map<const Bind *, int64_t> defs; // entry of each Bind
+    uint32_t str(const std::string &s);
+    int32_t add_ast(const AstP &a);
+};
+
+/** A read-only image, mapped from a file.
+ *
+ *  Ast-s are materialized on demand, and share sub-trees
+ *  the same way the saved Ast-s did.  A reference to entry k
+ *  becomes a pointer variable to resolve(k), which must be
+ *  an entry before the one being materialized.  Ast-s are kept
+ *  once materialized, so every call must resolve k to the same
+ *  Bind (use one TopEnv per image).
+ */
+struct Image {
+    // Throws std::runtime_error if the file is missing or malformed.
+    explicit Image(const std::string &fname);
+    ~Image();
+    Image(const Image &) = delete;
+    Image &operator=(const Image &) = delete;
+
+    typedef std::function<Bind *(size_t k)> Resolve;
+
+    size_t size() const { return hdr->nentry; }
+    const char *name(size_t i) const { return chars + entry(i).name; }
+    bool isT(size_t i) const { return entry(i).isT; }
+    bool ok(size_t i) const { return entry(i).ok; }
+    const char *errors(size_t i) const { return chars + entry(i).errors; }
+    AstP term(size_t i, const Resolve &resolve);
+    AstP type(size_t i, const Resolve &resolve);
+    // Latest entry named name that checked, or -1.
+    long find(const std::string &name) const;
+
+  private:
+    void *base = nullptr;
+    size_t len = 0;
+    const image::Header *hdr;
+    const image::Node *nodes;
+    const image::Entry *entries;
+    const uint32_t *index;
+    const char *chars;
+    std::unordered_map<int32_t, AstP> loaded; // nodes used so far
+
+    const image::Entry &entry(size_t i) const;
+    AstP ast(int32_t i, size_t in, const Resolve &resolve);
+};
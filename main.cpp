@@ -1,112 +1,732 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
 #include "ast.hpp"
 #include "stack.hpp"
 
 #include "unwind.hpp"
+#include "gen.hpp"
+#include "profile.hpp"
+#include "memstat.hpp"
+#include "prelude.hpp"
+#include "image.hpp"
+#include "bench.hpp"
+#include "fuel.hpp"
+#include "pool.hpp"
+#include "erase.hpp"
+#include "server.hpp"
 
-AstP Pair(AstP A, AstP B) {
-    AstP C = Var("C");
-    return ForAll("C", Top(), Fn(Fn(A, Fn(B, C)), C));
+struct Options {
+    bool quiet = false; // print only a compact result per entry
+    bool profile = false; // print a timing breakdown per entry
+    bool mem = false;     // print node counts per entry
+    bool drop_dead = false; // remove unused lets before winding
+    ImageWriter *save = nullptr; // collects checked entries
+    PrintLimits print;    // limits for printing stacks
+    bool dag = false;     // print shared sub-trees once (print_dag)
+    size_t max_errors = 10; // error budget per entry (0 = unlimited)
+    long fuel = -1;       // step budget for checking an entry
+    long mem_limit = -1;  // memory budget per entry, in bytes
+    bool eval = false;    // evaluate entries after checking them
+    long slice = -1;      // fuel per eval_need call (-1 = unlimited)
+    Pool *pool = nullptr; // evaluate in parallel (--jobs)
+    long cutoff = 64;     // smallest argument evaluated as a task
+    bool erase = false;   // evaluate the type-erased term
+};
+
+// Print an Ast as a tree, or as a DAG with --dag.
+static void print(const Options &opt, AstP a) {
+    if(opt.dag) {
+        print_dag(std::cout, a);
+    } else {
+        std::cout << a;
+    }
+}
+
+static std::string to_string(const ErrorList &err) {
+    std::ostringstream os;
+    os << err;
+    return os.str();
+}
+
+// Result of checking one entry, as saved in an image.
+struct Checked {
+    AstP type;          // null if the entry failed
+    std::string errors;
+    bool keep = false;  // return the checked stack ...
+    Stack *stack = nullptr; // ... here (owned by the caller)
+};
+
+// Hand s over to out->stack if requested, or free it.
+static void release(Checked *out, Stack *s) {
+    if(out && out->keep) {
+        out->stack = s;
+    } else {
+        stack_dtor(s);
+    }
+}
+
+/* get_ast and get_type have no safe points of their own, so the
+ * memory budget is also checked after each phase.  The error
+ * is only recorded once.
+ */
+static void out_of_memory(ErrorList &err) {
+    if(over_budget() && err.ok()) {
+        err.stop(mkError("Out of memory."), "out of memory");
+    }
 }
 
-void process(AstP a, bool isT) {
+/* Evaluate s in slices of opt.slice steps, resuming until done,
+ * or until fuel (the entry's) or the memory budget runs out,
+ * which is recorded in err.  Returns the number of slices.
+ */
+static long evaluate(const Options &opt, Stack *s, Fuel &fuel,
+                     ErrorList &err) {
+    long slices = 0;
+    bool done = false;
+    while(!done && !over_budget() && !fuel.empty()) {
+        // Each slice spends from the entry's fuel.
+        Fuel f(opt.slice);
+        if(fuel.left >= 0 && (f.left < 0 || f.left > fuel.left)) {
+            f.left = fuel.left.load();
+        }
+        long given = f.left;
+        {
+            FuelScope scope(f);
+            done = opt.pool ? eval_need_parallel(s, *opt.pool, opt.cutoff)
+                            : eval_need(s);
+        }
+        if(fuel.left >= 0) fuel.left -= given - f.left;
+        ++slices;
+    }
+    out_of_memory(err);
+    if(!done && err.ok()) {
+        err.stop(mkError("Out of fuel."), "out of fuel");
+    }
+    return slices;
+}
+
+/** Check one group entry, and evaluate or erase it if requested.
+ *
+ *  In quiet mode, no Ast is printed, only "OK" or the errors.
+ *  Returns true if the entry checked without errors.  If out
+ *  is non-null, the type or errors are also stored there,
+ *  and the checked stack if out->keep is set.
+ */
+bool process(const Options &opt, AstP a, bool isT, Checked *out = nullptr) {
+    PROFILE("process");
+    if(opt.drop_dead) {
+        a = drop_dead_lets(a);
+    }
     ErrorList err;
+    err.max_errors = opt.max_errors;
+    Fuel fuel(opt.fuel);
+    FuelScope scope(fuel);
+    MemBudget budget(opt.mem_limit);
+    MemBudgetScope mscope(budget);
     Stack *s = new Stack(err, nullptr, a, isT);
-    a = get_ast(s);
+    bool checked = false; // errors after checking are from eval
+    if(err.ok()) {
+        if(!opt.quiet) {
+            std::cout << "  Stack:   ";
+            print_stack(std::cout, s, opt.print);
+            std::cout << std::endl;
+        }
+        AstP t = get_type(err, s);
+        out_of_memory(err);
+        if(err.ok()) {
+            checked = true;
+            if(out) out->type = t;
+            if(!opt.quiet) {
+                std::cout << "  Type:   ";
+                print(opt, t);
+                std::cout << std::endl;
+            }
+        }
+    }
 
-    if(!err.ok()) {
-        std::cout << err;
-        std::cout << "In:   " << a << std::endl;
-        return;
+    if(err.ok() && opt.eval) {
+        long slices = evaluate(opt, s, fuel, err);
+        if(err.ok() && !opt.quiet) {
+            std::cout << "  Eval-d:  ";
+            print_stack(std::cout, s, opt.print);
+            std::cout << std::endl;
+            if(slices > 1) {
+                std::cout << "  (in " << slices << " slices)\n";
+            }
+        }
     }
-    std::cout << "  Stack:   " << a << std::endl;
 
-    AstP t = get_type(err, s);
     if(!err.ok()) {
         std::cout << err;
-        std::cout << "In:   " << a << std::endl;
-        return;
+        if(out) {
+            out->errors = to_string(err);
+            if(!checked) out->type = nullptr;
+        }
+        if(!opt.quiet && !checked) {
+            std::cout << "In:   ";
+            print_stack(std::cout, s, opt.print);
+            std::cout << std::endl;
+        }
+        stack_dtor(s);
+        return false;
     }
-    std::cout << "  Type:   " << t << std::endl;
 
-    //eval_need(s);
-    //std::cout << "Eval-d:  ";
-    //print_ast(get_ast(s), 0); std::cout << std::endl;
+    if(opt.erase && !isT) {
+        AstP n = normalize(erase(a));
+        if(!opt.quiet) {
+            std::cout << "  Erased:  ";
+            print(opt, n);
+            std::cout << std::endl;
+        }
+    }
+    if(opt.quiet) {
+        std::cout << "OK\n";
+    }
+    release(out, s);
+    return true;
+}
 
-    stack_dtor(s);
+// Number of nodes in an Ast, counting shared sub-trees
+// once per use (which is how winding visits them).
+static long count_nodes(AstP a) {
+    long n = 0;
+    for(; a != nullptr; a = a->child[1]) {
+        ++n;
+        if(a->child[0]) n += count_nodes(a->child[0]);
+    }
+    return n;
 }
 
-int main(int argc, char *argv[]) {
-    AstP T = Top();
-    AstP X = Var("X");
-    AstP A = Var("A");
-    AstP B = Var("B");
-    AstP C = Var("C");
-    AstP x = var("x");
-    AstP y = var("y");
-    AstP a = var("a");
-    AstP b = var("b");
-    AstP p = var("p");
-    AstP Bool = ForAll("X", T, Fn(X, Fn(X, X)));
-
-    AstP Id = ForAll("X", T, Fn(X, X));
-    AstP id = fnT("X", T, fn("x", X, x));
-    AstP g = Group("Id", Id, top());
-    g = group("id", id, g);
-    g = group("err1", app(id, top()), g);
-    g = group("err2", ForAll("A", T, app(appT(id, A), id)), g);
-    g = group("err3", app(appT(id, Id), top()), g);
-    g = group("id2", app(appT(id, Id), id), g);
-    g = Group("Bool",  Bool, g);
-    g = Group("True", ForAll("X", T, Fn(X, Fn(T, X))), g);
-    g = Group("False", ForAll("X", T, Fn(T, Fn(X, X))), g);
-    g = group("true", fnT("X", T, fn("x",X,fn("y",X,x))), g);
-    g = group("false", fnT("X", T, fn("x",X,fn("y",X,y))), g);
-    g = group("tt", fnT("X", T, fn("x",X,fn("y",T,x))), g);
-    g = group("ff", fnT("X", T, fn("x",T,fn("y",X,y))), g);
-    g = group("cond", fnT("X", T, fn("b",Bool,appT(var("b"),X))), g);
-
-    AstP P = Pair(A, B);
-    AstP pair = fnT("A", T, fnT("B", T, fn("a", A, fn("b", B,
-                            fnT("C", T,
-                                fn("p", Fn(A, Fn(B, C)),
-                                        app(app(p, a), b)))
-                            ))));
-    /*AstP pairT = ForAll("A", T, ForAll("B", T, Fn(A, Fn(B, pair(A,B)))));
-    AstP fstT  = ForAll("A", T, ForAll("B", T, Fn(P, A)));
-    AstP sndT  = ForAll("A", T, ForAll("B", T, Fn(P, B)));*/
-    g = group("pair", pair, g);
-    g = group("fst", fnT("A", T, fnT("B", T, fn("p", P,
-                        app(appT(p, A), fn("a",A,fn("b",B,a)))
-                   ))), g);
-    g = group("snd", fnT("A", T, fnT("B", T, fn("p", P,
-                        app(appT(p, B), fn("a",A,fn("b",B,b)))
-                   ))), g);
-    AstP once = fnT("A",T,fn("f", Fn(A, A),
-                                fn("x",A, app(var("f"),x) )));
-    g = group("once", once, g);
-    AstP twice = fnT("A",T,fn("f", Fn(A, A),
-                           fn("x", A,
-                               app(var("f"), app(var("f"), x))) ));
-    // TODO: improve error message for:
-                               //app(app(var("f"), x), x)) ));
-    g = group("twice", twice, g);
-    g = group("id1x", app(app(appT(once,Id), appT(id,Id)), id), g);
-    g = group("id2x", app(app(appT(twice,Id), appT(id,Id)), id), g);
+struct BatchStats {
+    long entries = 0;
+    long failed = 0;
+    long nodes = 0;
+
+    void print(std::ostream &os, double secs) const {
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        os << entries << " entries, " << failed << " failed, "
+           << nodes << " nodes in " << secs << " s\n";
+        if(secs > 0) {
+            os << "  " << entries/secs << " entries/s, "
+               << nodes/secs << " nodes/s\n";
+        }
+        os << "  peak memory " << ru.ru_maxrss << " kB\n";
+        InstStats::print(os);
+    }
+};
+
+/** Check every entry in the group chain g, numbering each one
+ *  first (unless already numbered).
+ *
+ *  Entries that check are added to a TopEnv (env, if given),
+ *  so later entries may refer to them by name.  Returns false
+ *  if any entry could not be numbered.
+ */
+bool check_group(const Options &opt, BatchStats &stats, AstP g,
+                 bool numbered = false, TopEnv *env = nullptr) {
+    TopEnv local;
+    if(env == nullptr) env = &local;
+    bool ok = true;
+    if(!opt.quiet) {
+        std::cout << "Initial = ";
+        print(opt, g);
+        std::cout << std::endl;
+    }
+
+    for(; g->t == Type::group || g->t == Type::Group; g=g->child[1]) {
+        if(opt.quiet) {
+            std::cout << g->name << ": ";
+        } else {
+            std::cout << "========== " << g->name << " ==========\n";
+        }
+        Trace::mark(g->name);
+        ++stats.entries;
+        bool isT = g->t == Type::Group;
+        AstP a = g->child[0];
+        if(!numbered) {
+            ErrorList err;
+            numberAst(err, &a, nullptr, env);
+            if(!err.ok()) {
+                std::cout << "Errors in numberAst:";
+                std::cout << err;
+                ++stats.failed;
+                ok = false;
+                continue;
+            }
+        }
+        stats.nodes += count_nodes(a);
+        MemStats::mark();
+        Checked c;
+        c.keep = true;
+        if(!process(opt, a, isT, &c)) {
+            ++stats.failed;
+        }
+        const Bind *def = nullptr;
+        if(c.stack) {
+            def = env->define(g->name, isT, c.stack, c.type);
+        }
+        if(opt.save) {
+            opt.save->add(g->name, isT, a, c.type, c.errors, def);
+        }
+        if(opt.mem) {
+            MemStats::print(std::cout);
+            InstStats::print_cache(std::cout);
+        }
+        if(opt.profile) {
+            Profile::print(std::cout);
+            Profile::reset();
+        }
+    }
+    return ok;
+}
+
+/** Report the saved results of every entry in an image,
+ *  in the same format as check_group.  env is the TopEnv over
+ *  img, which resolves the references in the types.
+ */
+void check_image(const Options &opt, BatchStats &stats, Image &img,
+                 const TopEnv &env) {
+    auto resolve = [&](size_t k) { return env.bind(k); };
+    for(size_t i=0; i<img.size(); ++i) {
+        if(opt.quiet) {
+            std::cout << img.name(i) << ": ";
+        } else {
+            printf("========== %s ==========\n", img.name(i));
+        }
+        ++stats.entries;
+        if(!img.ok(i)) {
+            ++stats.failed;
+            std::cout << img.errors(i);
+        } else if(opt.quiet) {
+            std::cout << "OK\n";
+        } else {
+            std::cout << "  Type:   " << img.type(i, resolve) << std::endl;
+        }
+    }
+}
+
+static bool read_file(const std::string &fname, std::string &text) {
+    std::ifstream f(fname);
+    if(!f) {
+        std::cout << fname << ": cannot open\n";
+        return false;
+    }
+    std::stringstream ss;
+    ss << f.rdbuf();
+    text = ss.str();
+    return true;
+}
+
+bool check_file(const Options &opt, BatchStats &stats,
+                const std::string &fname, TopEnv *env = nullptr) {
+    std::string text;
+    if(!read_file(fname, text)) return false;
 
     ErrorList err;
-    numberAst(err, &g);
+    AstP g = parse_module(err, text, fname);
     if(!err.ok()) {
-        std::cout << "Errors in numberAst:";
         std::cout << err;
-        return 1;
+        return false;
+    }
+    if(opt.quiet) {
+        std::cout << "# " << fname << "\n";
     }
-    std::cout << "Initial = " << g << std::endl;
+    return check_group(opt, stats, g, false, env);
+}
 
-    for(; g->t == Type::group || g->t == Type::Group; g=g->child[1]) {
-        printf("========== %s ==========\n", g->name.c_str());
-        process(g->child[0], g->t == Type::Group);
+// Budgets of each entry of a request, unless the server was
+// given --fuel or --mem-limit, so that no request can hang it.
+static constexpr long request_fuel = 10000000;
+static constexpr long request_mem_limit = 256L << 20;
+
+/* Answer one server request.  Its entries are checked in a TopEnv
+ * of their own, on top of the server's, so that requests are
+ * independent.  Output to std::cout is captured as the response.
+ */
+static std::string handle_request(const Options &server_opt,
+                                  const TopEnv &base, char op,
+                                  const std::string &text) {
+    if(op != 'c' && op != 'e') {
+        return "1Unknown request.\n";
+    }
+    Options opt = server_opt;
+    opt.quiet = op == 'c';
+    opt.eval = op == 'e';
+    opt.save = nullptr;
+    opt.mem = opt.profile = false;
+    if(opt.fuel < 0) opt.fuel = request_fuel;
+    if(opt.mem_limit < 0) opt.mem_limit = request_mem_limit;
+
+    std::ostringstream os;
+    std::streambuf *out = std::cout.rdbuf(os.rdbuf());
+    bool ok = false;
+    try {
+        ErrorList err;
+        AstP g = parse_module(err, text, "request");
+        if(!err.ok()) {
+            std::cout << err;
+        } else {
+            BatchStats stats;
+            TopEnv env(&base);
+            ok = check_group(opt, stats, g, false, &env)
+                 && stats.failed == 0;
+        }
+    } catch(std::exception &e) {
+        std::cout << e.what() << std::endl;
+        ok = false;
+    }
+    std::cout.rdbuf(out);
+    return (ok ? "0" : "1") + os.str();
+}
+
+/** Check the files (or the prelude) once, then serve requests
+ *  against their entries, and those of img (if given), on the
+ *  socket at path.
+ */
+static int run_server(const Options &opt, const std::vector<std::string> &files,
+                      const std::string &path, Image *img) {
+    TopEnv lib(img);
+    TopEnv base(&lib);
+    BatchStats stats;
+    if(files.size() == 0 && img == nullptr) {
+        check_group(opt, stats, prelude(), true, &base);
+    }
+    for(auto &f : files) {
+        check_file(opt, stats, f, &base);
+    }
+    std::cout << stats.entries << " entries, " << stats.failed
+              << " failed" << std::endl;
+    return serve(std::cout, path, [&](char op, const std::string &text) {
+        return handle_request(opt, base, op, text);
+    });
+}
+
+/** Send each file (or stdin) to the server at path, and print
+ *  the responses.  Returns 0 if every entry checked.
+ */
+static int run_client(const Options &opt, const std::vector<std::string> &files,
+                      const std::string &path, bool stop) {
+    int fd = connect_server(path);
+    if(fd < 0) {
+        perror(path.c_str());
+        return 2;
+    }
+    std::vector<std::string> texts;
+    if(!stop && files.size() == 0) {
+        std::stringstream ss;
+        ss << std::cin.rdbuf();
+        texts.push_back(ss.str());
+    }
+    for(auto &f : files) {
+        std::string text;
+        if(!read_file(f, text)) {
+            close(fd);
+            return 2;
+        }
+        texts.push_back(text);
+    }
+
+    int ret = 0;
+    std::string resp;
+    if(stop && !request(fd, 'q', "", resp)) {
+        ret = 2;
+    }
+    for(auto &text : texts) {
+        if(!request(fd, opt.eval ? 'e' : 'c', text, resp)
+                || resp.size() == 0) {
+            std::cout << path << ": connection lost\n";
+            ret = 2;
+            break;
+        }
+        std::cout << resp.substr(1);
+        if(resp[0] != '0') ret = 1;
+    }
+    close(fd);
+    return ret;
+}
+
+void usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " [-q] [file.fsub | dir ...]\n"
+              << "  Checks each module file (or every *.fsub file under\n"
+              << "  a directory).  Without files, checks the built-in\n"
+              << "  prelude.\n"
+              << "  -q  quiet: one result line per entry, no printing.\n"
+              << "  --profile  print a timing breakdown per entry.\n"
+              << "  --trace FILE  write Chrome trace-event JSON of every\n"
+              << "             checking step to FILE (chrome://tracing).\n"
+              << "  --mem      print live and peak node counts per entry.\n"
+              << "  --leaks    report Stack/Bind nodes still live at exit.\n"
+              << "  --drop-dead  skip unused let-bindings (their rhs is\n"
+              << "             not checked).\n"
+              << "  --max-errors N  stop checking an entry after N errors\n"
+              << "             (default 10, 0 = no limit).\n"
+              << "  --first-error   same as --max-errors 1.\n"
+              << "  --fuel N   stop checking an entry after N steps.\n"
+              << "  --mem-limit K  fail an entry once its live nodes\n"
+              << "             take more than K kB.\n"
+              << "  --eval     evaluate each entry after checking it.\n"
+              << "  --slice N  evaluate in slices of N steps, resuming\n"
+              << "             until done.\n"
+              << "  --jobs N   evaluate on N threads, forking independent\n"
+              << "             arguments of at least --cutoff N Stacks\n"
+              << "             (default 64).\n"
+              << "  --erase    also evaluate each entry with its types\n"
+              << "             erased.\n"
+              << "  --dag      print sub-trees shared by Ast-s once, as $k.\n"
+              << "  --print-depth D, --print-size N  elide stacks nested\n"
+              << "             deeper than D, or after N nodes, with \"...\".\n"
+              << "  --save-image FILE  save the checked entries as an image.\n"
+              << "  --load-image FILE  check the files against the entries\n"
+              << "             saved in an image (instead of the prelude),\n"
+              << "             or without files, report the saved results.\n"
+              << "\n"
+              << "       " << prog << " --serve SOCK [options] [file.fsub ...]\n"
+              << "  Checks the files (or the prelude) once, then serves\n"
+              << "  check requests referring to their entries (and those\n"
+              << "  of --load-image) on the Unix socket SOCK (see\n"
+              << "  server.hpp).  Each entry of a request is limited to\n"
+              << "  --fuel and --mem-limit, or by default 10M steps and\n"
+              << "  256 MB.\n"
+              << "       " << prog << " --client SOCK [--eval] [--stop]"
+                                     " [file.fsub ...]\n"
+              << "  Sends each file (or stdin) to the server as a check\n"
+              << "  (or eval) request.  --stop stops the server.\n"
+              << "       " << prog << " --load SOCK [--eval] [--requests N]"
+                                     " [--conns C] file.fsub\n"
+              << "  Sends N requests (default 1000) over C connections, and\n"
+              << "  reports throughput and latency percentiles.\n"
+              << "\n"
+              << "       " << prog << " --random N [--seed S] [--size N]"
+                                     " [--depth D]\n"
+              << "          [--share P] [--slow MS] [--save DIR] [-v]\n"
+              << "  Generates N random well-typed terms and cross-checks\n"
+              << "  the checker on each.  Terms slower than MS are\n"
+              << "  minimized and saved as DIR/slow-<seed>.fsub.\n"
+              << "\n"
+              << "       " << prog << " --bench-alias D\n"
+              << "  Times checking nested type aliases up to depth D.\n"
+              << "       " << prog << " --bench-renumber N\n"
+              << "  Times renumbering a type with N variables, by tree\n"
+              << "  walks and by the flat node array kernels.\n"
+              << "       " << prog << " --bench-erase N\n"
+              << "  Times evaluating 2^k (k <= N) with Church numerals,\n"
+              << "  by eval_need and on the type-erased term.\n";
+}
+
+int main(int argc, char *argv[]) {
+    Options opt;
+    GenOptions gen;
+    bool random = false;
+    int bench_alias = 0;
+    int bench_renum = 0;
+    int bench_erased = 0;
+    std::string save_image, load_image;
+    std::string serve_path, client_path, load_path;
+    bool stop = false;
+    long requests = 1000;
+    int conns = 1;
+    const char *trace = nullptr;
+    int jobs = 1;
+    std::vector<std::string> files;
+    for(int i=1; i<argc; ++i) {
+        // options taking a value
+        const char *val = i+1 < argc ? argv[i+1] : nullptr;
+        if(!strcmp(argv[i], "-q")) {
+            opt.quiet = true;
+        } else if(!strcmp(argv[i], "--profile")) {
+#ifdef FSUB_PROFILE
+            opt.profile = Profile::enabled = true;
+#else
+            std::cerr << "Profiling not compiled in (build with PROFILE=1).\n";
+#endif
+        } else if(val && !strcmp(argv[i], "--trace")) {
+            trace = val; ++i;
+        } else if(!strcmp(argv[i], "--mem")) {
+            opt.mem = true;
+        } else if(!strcmp(argv[i], "--drop-dead")) {
+            opt.drop_dead = true;
+        } else if(!strcmp(argv[i], "--dag")) {
+            opt.dag = true;
+        } else if(!strcmp(argv[i], "--leaks")) {
+            MemStats::report_leaks = true;
+        } else if(!strcmp(argv[i], "-v")) {
+            gen.verbose = true;
+        } else if(val && !strcmp(argv[i], "--random")) {
+            random = true;
+            gen.count = atoi(val); ++i;
+        } else if(val && !strcmp(argv[i], "--seed")) {
+            gen.seed = strtoul(val, nullptr, 10); ++i;
+        } else if(val && !strcmp(argv[i], "--size")) {
+            gen.size = atoi(val); ++i;
+        } else if(val && !strcmp(argv[i], "--depth")) {
+            gen.depth = atoi(val); ++i;
+        } else if(val && !strcmp(argv[i], "--share")) {
+            gen.share = atof(val); ++i;
+        } else if(val && !strcmp(argv[i], "--slow")) {
+            gen.slow_ms = atof(val); ++i;
+        } else if(!strcmp(argv[i], "--eval")) {
+            opt.eval = true;
+        } else if(!strcmp(argv[i], "--erase")) {
+            opt.erase = true;
+        } else if(val && !strcmp(argv[i], "--jobs")) {
+            jobs = atoi(val); ++i;
+        } else if(val && !strcmp(argv[i], "--cutoff")) {
+            opt.cutoff = atol(val); ++i;
+        } else if(val && !strcmp(argv[i], "--slice")) {
+            opt.slice = atol(val); ++i;
+        } else if(val && !strcmp(argv[i], "--fuel")) {
+            opt.fuel = atol(val); ++i;
+        } else if(val && !strcmp(argv[i], "--mem-limit")) {
+            opt.mem_limit = atol(val)*1024; ++i;
+        } else if(!strcmp(argv[i], "--first-error")) {
+            opt.max_errors = 1;
+        } else if(val && !strcmp(argv[i], "--max-errors")) {
+            opt.max_errors = atol(val); ++i;
+        } else if(val && !strcmp(argv[i], "--print-depth")) {
+            opt.print.max_depth = atoi(val); ++i;
+        } else if(val && !strcmp(argv[i], "--print-size")) {
+            opt.print.max_size = atol(val); ++i;
+        } else if(val && !strcmp(argv[i], "--bench-renumber")) {
+            bench_renum = atoi(val); ++i;
+        } else if(val && !strcmp(argv[i], "--bench-erase")) {
+            bench_erased = atoi(val); ++i;
+        } else if(val && !strcmp(argv[i], "--bench-alias")) {
+            bench_alias = atoi(val); ++i;
+        } else if(val && !strcmp(argv[i], "--save-image")) {
+            save_image = val; ++i;
+        } else if(val && !strcmp(argv[i], "--load-image")) {
+            load_image = val; ++i;
+        } else if(val && !strcmp(argv[i], "--serve")) {
+            serve_path = val; ++i;
+        } else if(val && !strcmp(argv[i], "--client")) {
+            client_path = val; ++i;
+        } else if(val && !strcmp(argv[i], "--load")) {
+            load_path = val; ++i;
+        } else if(!strcmp(argv[i], "--stop")) {
+            stop = true;
+        } else if(val && !strcmp(argv[i], "--requests")) {
+            requests = atol(val); ++i;
+        } else if(val && !strcmp(argv[i], "--conns")) {
+            conns = atoi(val); ++i;
+        } else if(val && !strcmp(argv[i], "--save")) {
+            gen.save_dir = val; ++i;
+        } else if(argv[i][0] == '-') {
+            usage(argv[0]);
+            return 2;
+        } else if(std::filesystem::is_directory(argv[i])) {
+            std::vector<std::string> found;
+            for(auto &e : std::filesystem::recursive_directory_iterator(argv[i])) {
+                if(e.is_regular_file() && e.path().extension() == ".fsub") {
+                    found.push_back(e.path().string());
+                }
+            }
+            std::sort(found.begin(), found.end());
+            files.insert(files.end(), found.begin(), found.end());
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+
+    if(trace) {
+#ifdef FSUB_PROFILE
+        if(!Trace::open(trace)) {
+            std::cerr << trace << ": cannot open\n";
+            return 2;
+        }
+        atexit(Trace::close);
+#else
+        std::cerr << "Tracing not compiled in (build with PROFILE=1).\n";
+#endif
+    }
+
+    if(random) {
+        return random_check(gen) == 0 ? 0 : 1;
+    }
+    if(bench_alias > 0) {
+        return bench_aliases(std::cout, bench_alias) == 0 ? 0 : 1;
+    }
+    if(bench_renum > 0) {
+        return bench_renumber(std::cout, bench_renum) == 0 ? 0 : 1;
+    }
+    if(bench_erased > 0) {
+        return bench_erase(std::cout, bench_erased) == 0 ? 0 : 1;
+    }
+    if(client_path.size() > 0) {
+        return run_client(opt, files, client_path, stop);
+    }
+    if(load_path.size() > 0) {
+        std::string text;
+        if(files.size() != 1) {
+            usage(argv[0]);
+            return 2;
+        }
+        if(!read_file(files[0], text)) return 2;
+        return load_test(std::cout, load_path, opt.eval ? 'e' : 'c', text,
+                         requests, conns) == 0 ? 0 : 1;
+    }
+
+    std::unique_ptr<Pool> pool;
+    if(jobs > 1) {
+        pool.reset(new Pool(jobs));
+        opt.pool = pool.get();
+    }
+
+    // Mapped only; entries are read as files refer to them.
+    std::unique_ptr<Image> img;
+    if(load_image.size() > 0) {
+        try {
+            img.reset(new Image(load_image));
+        } catch(std::runtime_error &e) {
+            std::cout << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if(serve_path.size() > 0) {
+        return run_server(opt, files, serve_path, img.get());
+    }
+
+    ImageWriter writer;
+    if(save_image.size() > 0) {
+        opt.save = &writer;
+    }
+
+    BatchStats stats;
+    auto t0 = std::chrono::steady_clock::now();
+    bool ok = true;
+    TopEnv lib(img.get()); // empty without --load-image
+    try {
+        if(img && files.size() == 0) {
+            check_image(opt, stats, *img, lib);
+        } else if(files.size() == 0) {
+            ok = check_group(opt, stats, prelude(), true);
+        }
+        for(auto &f : files) {
+            TopEnv env(&lib);
+            ok = check_file(opt, stats, f, &env) && ok;
+        }
+    } catch(std::runtime_error &e) {
+        std::cout << e.what() << std::endl;
+        ok = false;
+    }
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - t0;
+
+    if(save_image.size() > 0 && !writer.write(save_image)) {
+        std::cout << save_image << ": cannot write\n";
+        ok = false;
+    }
+
+    if(opt.quiet || files.size() > 0) {
+        stats.print(std::cout, dt.count());
     }
-    return 0;
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,65 @@
+#include <stdio.h>
+
+#include "ast.hpp"
+#include "stack.hpp"
+#include "memstat.hpp"
+
+template <> MemStat Counted<Stack>::stat("Stack", sizeof(Stack));
+template <> MemStat Counted<StackExtra>::stat("Extra", sizeof(StackExtra));
+template <> MemStat Counted<Bind>::stat("Bind", sizeof(Bind));
+template <> MemStat Counted<Ast>::stat("Ast", sizeof(Ast));
+template <> MemStat Counted<Traceback>::stat("Traceback", sizeof(Traceback));
+
+bool MemStats::report_leaks = false;
+thread_local MemBudget *MemBudget::cur = nullptr;
+
+static MemStat *const all[] = {
+    &Counted<Stack>::stat,
+    &Counted<StackExtra>::stat,
+    &Counted<Bind>::stat,
+    &Counted<Ast>::stat,
+    &Counted<Traceback>::stat
+};
+
+void MemStats::mark() {
+    for(MemStat *m : all) m->mark();
+}
+
+void MemStats::print(std::ostream &os) {
+    char line[128];
+    snprintf(line, sizeof(line), "  %-10s %8s %10s %8s %10s\n",
+             "Memory", "live", "bytes", "peak", "bytes");
+    os << line;
+    for(MemStat *m : all) {
+        long live = m->live, peak = m->peak;
+        snprintf(line, sizeof(line), "    %-8s %8ld %10ld %8ld %10ld\n",
+                 m->name, live, live*(long)m->size,
+                 peak, peak*(long)m->size);
+        os << line;
+    }
+}
+
+long MemStats::total() {
+    long n = 0;
+    for(MemStat *m : all) n += m->total;
+    return n;
+}
+
+long MemStats::leaked() {
+    return Counted<Stack>::stat.live + Counted<Bind>::stat.live;
+}
+
+/* Reports leaks after main() returns and its locals are gone.
+ * Ast-s may still be held by static tables, so only Stack
+ * and Bind (whose ownership is managed by hand) are checked.
+ */
+static struct LeakReport {
+    ~LeakReport() {
+        if(!MemStats::report_leaks) return;
+        long n = MemStats::leaked();
+        if(n == 0) return;
+        fprintf(stderr, "Leaked %ld Stack and %ld Bind nodes.\n",
+                Counted<Stack>::stat.live.load(),
+                Counted<Bind>::stat.live.load());
+    }
+} leak_report;
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+#include <iostream>
+#include <string>
+
+/** Memory budget for one request.
+ *
+ *  Every Stack, Bind, Ast and Traceback constructed by this thread
+ *  while a MemBudgetScope is installed is charged to it, along with
+ *  the heap bytes of Ast names and interned binder names.  Each
+ *  object records the id of the budget it was charged to, and is
+ *  refunded only if destroyed while that budget is current (frees
+ *  of other budgets' objects are ignored).  Once the live total exceeds the
+ *  limit, the budget is exceeded for good, so that the request
+ *  fails consistently even if memory is released again:
+ *  - wind (and so checking) records an "Out of memory." error
+ *    and stops at the next safe point, as for running out of fuel;
+ *  - subType fails with an "Out of memory." traceback;
+ *  - eval_need returns false.
+ *  Without a MemBudgetScope, memory is unlimited.  The tasks of
+ *  eval_need_parallel are charged to their caller's budget, from
+ *  several threads at once, so the counters are atomic.
+ */
+struct MemBudget {
+    long limit = -1;     ///< bytes (-1 = unlimited)
+    std::atomic<long> used{0}; ///< live bytes charged to this budget
+    std::atomic<long> peak{0};
+    std::atomic<bool> exceeded{false};
+    const unsigned id;   ///< never 0, which stands for no budget
+
+    MemBudget() : id(next_id()) {}
+    explicit MemBudget(long bytes) : limit(bytes), id(next_id()) {}
+    MemBudget(const MemBudget &) = delete;
+    MemBudget &operator=(const MemBudget &) = delete;
+
+    void charge(long n) {
+        long u = used.fetch_add(n, std::memory_order_relaxed) + n;
+        long p = peak.load(std::memory_order_relaxed);
+        while(u > p && !peak.compare_exchange_weak(p, u,
+                                                   std::memory_order_relaxed));
+        if(limit >= 0 && u > limit) exceeded = true;
+    }
+
+    static thread_local MemBudget *cur;
+
+  private:
+    static unsigned next_id() {
+        static std::atomic<unsigned> last{0};
+        unsigned n;
+        while((n = ++last) == 0); // skip 0 on wrap-around
+        return n;
+    }
+};
+
+// Install b as the memory budget for this thread, while in scope.
+struct MemBudgetScope {
+    MemBudget *prev;
+    MemBudgetScope(MemBudget &b) : prev(MemBudget::cur) { MemBudget::cur = &b; }
+    ~MemBudgetScope() { MemBudget::cur = prev; }
+};
+
+inline bool over_budget() {
+    return MemBudget::cur != nullptr && MemBudget::cur->exceeded;
+}
+
+/** Charge n bytes to the current budget.  Returns its id (or 0),
+ *  which must be passed to mem_refund when they are freed.
+ */
+inline unsigned mem_charge(long n) {
+    MemBudget *b = MemBudget::cur;
+    if(b == nullptr) return 0;
+    b->charge(n);
+    return b->id;
+}
+// Refund n bytes charged to budget `owner`, if it is current.
+inline void mem_refund(unsigned owner, long n) {
+    MemBudget *b = MemBudget::cur;
+    if(owner != 0 && b != nullptr && b->id == owner) b->charge(-n);
+}
+// Bytes s allocated on the heap (0 for short, inline strings).
+inline long heap_bytes(const std::string &s) {
+    const char *p = s.data();
+    bool inline_buf = p >= (const char *)&s && p < (const char *)(&s + 1);
+    return inline_buf ? 0 : (long)s.capacity() + 1;
+}
+
+/** Live and peak object counts for one class.
+ *  Atomic, since parallel eval_need allocates from many threads.
+ */
+struct MemStat {
+    const char *name;
+    size_t size;     ///< sizeof one object
+    std::atomic<long> live{0};
+    std::atomic<long> peak{0};  ///< high-water mark of live since the last mark()
+    std::atomic<long> total{0}; ///< constructions since program start
+
+    MemStat(const char *_name, size_t _size) : name(_name), size(_size) {}
+
+    // Returns the id of the budget charged (see mem_charge).
+    unsigned add() {
+        ++total;
+        long n = ++live, p = peak;
+        while(n > p && !peak.compare_exchange_weak(p, n));
+        return mem_charge(size);
+    }
+    void sub(unsigned owner) {
+        --live;
+        mem_refund(owner, size);
+    }
+    void mark() {
+        peak = live.load();
+    }
+};
+
+/** Base class counting constructions and destructions of T.
+ *
+ *  Derive as `struct Stack : Counted<Stack>`.  The base holds
+ *  only the id of the owning MemBudget, which fits in the
+ *  padding before T's one-byte tag in Stack, Ast and Traceback.
+ */
+template <typename T>
+struct Counted {
+    static MemStat stat;
+    const unsigned budget; ///< MemBudget charged for this object (0 = none)
+
+    Counted() : budget(stat.add()) {}
+    Counted(const Counted &) : budget(stat.add()) {}
+    Counted &operator=(const Counted &) { return *this; }
+    ~Counted() { stat.sub(budget); }
+};
+
+// memstat.cpp
+struct Stack;
+struct StackExtra;
+struct Bind;
+struct Ast;
+struct Traceback;
+template <> MemStat Counted<Stack>::stat;
+template <> MemStat Counted<StackExtra>::stat;
+template <> MemStat Counted<Bind>::stat;
+template <> MemStat Counted<Ast>::stat;
+template <> MemStat Counted<Traceback>::stat;
+
+/** Accounting for all node types. */
+struct MemStats {
+    static bool report_leaks; ///< report live nodes at exit
+
+    // Start a new high-water mark (e.g. per checked entry).
+    static void mark();
+    // Print live and peak counts and bytes.
+    static void print(std::ostream &os);
+    // Returns the number of live Stack and Bind nodes
+    // (which are owned by hand and should reach zero).
+    static long leaked();
+    // Returns the number of nodes of every type constructed so far.
+    static long total();
+};
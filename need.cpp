@@ -1,13 +1,19 @@
 #include <stdio.h>
+#include <unordered_set>
 
 #include "ast.hpp"
 #include "stack.hpp"
 
 #include "unwind.hpp"
+#include "profile.hpp"
+#include "fuel.hpp"
+#include "pool.hpp"
+#include "memstat.hpp"
 
-void eval_need(Stack *s);
+bool eval_need(Stack *s);
 
 void relink_ctxt(Stack *s, Bind *old, Bind *next) {
+    s->modified();
     for(Bind **x = &s->ctxt; *x != nullptr; x=&(*x)->next) {
         if(*x == old) {
             *x = next;
@@ -17,21 +23,113 @@ void relink_ctxt(Stack *s, Bind *old, Bind *next) {
     fprintf(stderr, "Error: old binding not found!\n");
 }
 
+// Arguments of at least this many Stacks are evaluated as pool
+// tasks (0 = sequential).  Set per thread by a ForkScope.
+static thread_local long fork_cutoff = 0;
+
+/* The state of one eval_need_parallel call, installed on each
+ * thread running part of it (the caller, and the pool thread
+ * running each task) while in scope: its cutoff, the caller's
+ * Fuel and MemBudget, and no get_ast caching.
+ */
+struct ForkScope {
+    long prev_cutoff;
+    Fuel *prev_fuel;
+    MemBudget *prev_budget;
+    bool prev_cache;
+
+    ForkScope(long cutoff, Fuel *fuel, MemBudget *budget)
+        : prev_cutoff(fork_cutoff), prev_fuel(Fuel::cur),
+          prev_budget(MemBudget::cur), prev_cache(Stack::cache_ast) {
+        fork_cutoff = cutoff;
+        Fuel::cur = fuel;
+        MemBudget::cur = budget;
+        Stack::cache_ast = false; // tasks read get_ast-s of shared binders
+    }
+    ~ForkScope() {
+        fork_cutoff = prev_cutoff;
+        Fuel::cur = prev_fuel;
+        MemBudget::cur = prev_budget;
+        Stack::cache_ast = prev_cache;
+    }
+};
+
+/* Can b be evaluated on another thread?
+ *
+ * Evaluating a variable evaluates (and re-winds) its binder's rhs,
+ * so b is only forked if it has no variables bound to a let-binder
+ * (a Bind with rhs) outside of b.  Everything else b touches
+ * outside itself is read-only, or an atomic nref.  The walk stops
+ * early once b is known to be open, or big enough.
+ */
+struct ForkCheck {
+    std::unordered_set<const Bind *> inner; // binders within b
+    long size = 0;
+    bool closed = true;
+
+    void visit(const Stack *s) {
+        if(!closed) return;
+        ++size;
+        for(const Bind *c = s->ctxt; c != nullptr; c = c->next) {
+            inner.insert(c);
+        }
+        if((s->t == Type::Var || s->t == Type::var) && s->ref
+                && s->ref->rhs != nullptr && !inner.count(s->ref)) {
+            closed = false;
+            return;
+        }
+        for(const Bind *c = s->ctxt; c != nullptr; c = c->next) {
+            if(c->rht) visit(c->rht);
+            if(c->rhs) visit(c->rhs);
+        }
+        for(const Stack *b = s->app; b != nullptr; b = b->next) {
+            visit(b);
+        }
+    }
+};
+
+static bool can_fork(const Stack *b) {
+    if(fork_cutoff <= 0 || Pool::cur == nullptr) return false;
+    ForkCheck F;
+    F.visit(b);
+    return F.closed && F.size >= fork_cutoff;
+}
+
 /* Fold doing full eval and removing all let-binders. */
 struct EvalNeed {
     Stack *spine;
+    TaskGroup tasks; // arguments being evaluated by the pool
 
     EvalNeed(Stack *_spine) : spine(_spine) {}
 
+    // Wait for forked arguments, before binders are removed.
+    void join() {
+        if(tasks.pending > 0) Pool::cur->wait(tasks);
+    }
+
     bool need_var(Stack *s) {
         Bind *ref = s->ref;
         if(ref->rhs == nullptr)
             return true;
-        eval_need(ref->rhs);
+        // Type aliases stay references.
+        if(isAlias(ref))
+            return true;
+        // Out of fuel: stop the trampoline.  The variable
+        // is still in place, so the next call resumes here.
+        // Only substitutions spend fuel, so that every slice
+        // makes progress however deep the rhs chain is.
+        // A borrowed rhs belongs to another stack (or to a
+        // TopEnv, shared between modules and requests), and is
+        // substituted as it is, so that the copy is evaluated.
+        if((!ref->borrowed && !eval_need(ref->rhs))
+                || over_budget() || !spend_fuel())
+            return true;
 
         AstP rhs = get_ast(ref->rhs); // locally nameless Ast
         --ref->nref;
         ErrorList E; // FIXME: these should not throw in a properly typed term
+        Fuel unlimited; // a substitution is one step, never cut short
+        FuelScope scope(unlimited);
         if(bindType(ref->t)) { // note: this is a non-term
             s->windType(E, rhs);
             return true;
@@ -58,6 +156,7 @@ struct EvalNeed {
 
     // Remove the binding if unused.
     void bind(Bind *c) {
+        join();
         if(c->rhs == nullptr || c->nref > 0) { // keep
             /*if(c->rht != nullptr) {
                 eval_need(c->rht);
@@ -66,22 +165,62 @@ struct EvalNeed {
             }*/
         } else { // variable is unused! -- discard Binding c
             if(c->nref < 0) {
-                fprintf(stderr, "%s has %d refs??\n", c->name.c_str(), c->nref);
+                fprintf(stderr, "%s has %d refs??\n", c->name.c_str(),
+                        c->nref.load());
             }
             if(c->rht != nullptr)
                 stack_dtor(c->rht);
-            stack_dtor(c->rhs);
+            if(!c->borrowed)
+                stack_dtor(c->rhs);
             relink_ctxt(spine, c, c->next);
             delete c;
         }
     }
 
     void apply(Stack *b) {
-        eval_need(b);
+        if(can_fork(b)) {
+            long cutoff = fork_cutoff;
+            Fuel *fuel = Fuel::cur;
+            MemBudget *budget = MemBudget::cur;
+            Pool::cur->spawn(tasks, [b, cutoff, fuel, budget]() {
+                ForkScope scope(cutoff, fuel, budget);
+                eval_need(b);
+            });
+        } else {
+            eval_need(b);
+        }
     }
 };
 
-void eval_need(Stack *s) {
+/** Evaluate s by need, removing unused let-binders.
+ *
+ *  Returns false if the current Fuel ran out first (or the
+ *  MemBudget is exceeded).  s is then partially evaluated (but
+ *  equivalent), and calling eval_need again continues the
+ *  evaluation.
+ */
+bool eval_need(Stack *s) {
+    PROFILE("eval_need");
+    s->modified();
+    if(s->x) s->x->type = nullptr; // binders referenced by the type may be removed
     EvalNeed need(s);
     unwind(&need, s);
+    need.join();
+    return !out_of_fuel() && !over_budget();
+}
+
+/** eval_need, forking independent application arguments of at
+ *  least `cutoff` Stacks as tasks on `pool`.  Gives the same
+ *  result as eval_need.  The tasks spend the caller's Fuel and
+ *  are charged to its MemBudget, and an exception thrown by one
+ *  of them is rethrown here.
+ */
+bool eval_need_parallel(Stack *s, Pool &pool, long cutoff) {
+    struct PoolScope {
+        Pool *prev = Pool::cur;
+        PoolScope(Pool &p) { Pool::cur = &p; }
+        ~PoolScope() { Pool::cur = prev; }
+    } pscope(pool);
+    ForkScope scope(cutoff, Fuel::cur, MemBudget::cur);
+    return eval_need(s);
 }
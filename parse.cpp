@@ -0,0 +1,216 @@
+#include <ctype.h>
+#include <string.h>
+#include <sstream>
+#include <vector>
+
+#include "ast.hpp"
+
+/* Recursive-descent parser for module files.
+ *
+ *  module := { name '=' term ';' | Name '=:' type ';' }
+ *  type   := 'All' '(' X ['<:' type] ')' type
+ *          | atype ['->' type]
+ *  atype  := 'Top' | X | '(' type ')'
+ *  term   := 'fn' '(' x ':' type ')' term
+ *          | 'fn' '(' X '<:' type ')' term
+ *          | 'let' x ':' type '=' term 'in' term
+ *          | 'Let' X '<:' type '=' type 'in' term
+ *          | atom { '(' term ')' | '(' ':' type ')' }
+ *  atom   := 'top' | x | '(' term ')'
+ *
+ * Comments run from '#' to the end of the line.
+ * The result is a chain of group/Group entries (in file order)
+ * ending in `top`, the same shape as the prelude built in main().
+ */
+struct Parser {
+    const std::string &text;
+    const std::string &fname;
+    size_t pos = 0;
+    int line = 1;
+    TracebackP error;
+
+    Parser(const std::string &_text, const std::string &_fname)
+        : text(_text), fname(_fname) {}
+
+    void fail(const std::string &what) {
+        if(error) return; // keep the first error only
+        std::stringstream ss;
+        ss << fname << ":" << line << ": " << what;
+        error = mkError(ss.str());
+    }
+
+    void skip() {
+        while(pos < text.size()) {
+            char c = text[pos];
+            if(c == '#') {
+                while(pos < text.size() && text[pos] != '\n') ++pos;
+            } else if(isspace((unsigned char)c)) {
+                if(c == '\n') ++line;
+                ++pos;
+            } else {
+                break;
+            }
+        }
+    }
+    bool at_end() {
+        skip();
+        return pos >= text.size();
+    }
+    // Consume the punctuation `tok` if it is next.
+    bool accept(const char *tok) {
+        skip();
+        size_t n = strlen(tok);
+        if(text.compare(pos, n, tok) != 0) return false;
+        pos += n;
+        return true;
+    }
+    void expect(const char *tok) {
+        if(!accept(tok)) {
+            fail(std::string("Expected '") + tok + "'.");
+        }
+    }
+    static bool ident_char(char c) {
+        return isalnum((unsigned char)c) || c == '_' || c == '\'';
+    }
+    std::string peek_ident() {
+        skip();
+        size_t end = pos;
+        while(end < text.size() && ident_char(text[end])) ++end;
+        return text.substr(pos, end-pos);
+    }
+    bool accept_kw(const char *kw) {
+        if(peek_ident() != kw) return false;
+        pos += strlen(kw);
+        return true;
+    }
+    std::string ident() {
+        std::string name = peek_ident();
+        if(name.size() == 0 || isdigit((unsigned char)name[0])) {
+            fail("Expected an identifier.");
+            return "_";
+        }
+        pos += name.size();
+        return name;
+    }
+
+    AstP type() {
+        if(error) return Top();
+        if(accept_kw("All")) {
+            expect("(");
+            std::string name = ident();
+            AstP A = accept("<:") ? type() : Top();
+            expect(")");
+            return ForAll(name, A, type());
+        }
+        AstP A = atype();
+        if(accept("->")) {
+            return Fn(A, type());
+        }
+        return A;
+    }
+    AstP atype() {
+        if(accept("(")) {
+            AstP A = type();
+            expect(")");
+            return A;
+        }
+        if(accept_kw("Top")) return Top();
+        return Var(ident());
+    }
+
+    AstP term() {
+        if(error) return top();
+        if(accept_kw("fn")) {
+            expect("(");
+            std::string name = ident();
+            if(accept("<:")) {
+                AstP A = type();
+                expect(")");
+                return fnT(name, A, term());
+            }
+            expect(":");
+            AstP A = type();
+            expect(")");
+            return fn(name, A, term());
+        }
+        if(accept_kw("let")) {
+            std::string name = ident();
+            expect(":");
+            AstP A = type();
+            expect("=");
+            AstP a = term();
+            if(!accept_kw("in")) fail("Expected 'in'.");
+            return app(fn(name, A, term()), a);
+        }
+        if(accept_kw("Let")) {
+            std::string name = ident();
+            expect("<:");
+            AstP A = type();
+            expect("=");
+            AstP B = type();
+            if(!accept_kw("in")) fail("Expected 'in'.");
+            return appT(fnT(name, A, term()), B);
+        }
+        AstP a = atom();
+        while(!error && accept("(")) {
+            if(accept(":")) {
+                a = appT(a, type());
+            } else {
+                a = app(a, term());
+            }
+            expect(")");
+        }
+        return a;
+    }
+    AstP atom() {
+        if(accept("(")) {
+            AstP a = term();
+            expect(")");
+            return a;
+        }
+        if(accept_kw("top")) return top();
+        return var(ident());
+    }
+
+    // Entries are linked in file order, so they are built
+    // back to front once the whole file has been read.
+    AstP module() {
+        std::vector<AstP> entries;
+        while(!error && !at_end()) {
+            std::string name = ident();
+            AstP e;
+            if(accept("=:")) {
+                e = Group(name, type(), nullptr);
+            } else {
+                expect("=");
+                e = group(name, term(), nullptr);
+            }
+            if(!accept(";") && !at_end()) {
+                fail("Expected ';' after definition.");
+            }
+            entries.push_back(e);
+        }
+        AstP g = top();
+        for(auto it = entries.rbegin(); it != entries.rend(); ++it) {
+            (*it)->child[1] = g;
+            g = *it;
+        }
+        return g;
+    }
+};
+
+/** Parse the text of a module file into a group chain.
+ *
+ *  On a syntax error, appends it to err and returns nullptr.
+ *  `fname` is only used to label error messages.
+ */
+AstP parse_module(ErrorList &err, const std::string &text,
+                  const std::string &fname) {
+    Parser P(text, fname);
+    AstP g = P.module();
+    if(P.error) {
+        err.append(std::move(P.error));
+        return nullptr;
+    }
+    return g;
+}
@@ -0,0 +1,94 @@
+#include "pool.hpp"
+#include "profile.hpp"
+
+thread_local Pool *Pool::cur = nullptr;
+thread_local int Pool::self = 0;
+
+Pool::Pool(int nthreads) {
+    if(nthreads < 1) nthreads = 1;
+    for(int i=0; i<nthreads; ++i) {
+        queues.emplace_back(new Queue);
+    }
+    cur = this;
+    self = 0;
+    for(int i=1; i<nthreads; ++i) {
+        threads.emplace_back(&Pool::worker, this, i);
+    }
+}
+
+Pool::~Pool() {
+    {
+        std::lock_guard<std::mutex> lock(idle_m);
+        done = true;
+    }
+    idle.notify_all();
+    for(std::thread &t : threads) t.join();
+    if(cur == this) cur = nullptr;
+}
+
+void Pool::worker(int i) {
+    cur = this;
+    self = i;
+    Profile::worker = true; // the profiler is single-threaded
+    while(!done) {
+        if(run_one()) continue;
+        std::unique_lock<std::mutex> lock(idle_m);
+        idle.wait(lock, [this]() { return done || queued > 0; });
+    }
+}
+
+void Pool::spawn(TaskGroup &g, Task f) {
+    ++g.pending;
+    {
+        Queue &Q = *queues[self];
+        std::lock_guard<std::mutex> lock(Q.m);
+        Q.q.emplace_back(&g, std::move(f));
+    }
+    // Taking idle_m orders this with a worker about to sleep.
+    {
+        std::lock_guard<std::mutex> lock(idle_m);
+        ++queued;
+    }
+    idle.notify_one();
+}
+
+// Run one task, own (newest first) or stolen (oldest first).
+bool Pool::run_one() {
+    std::pair<TaskGroup *, Task> t;
+    int n = queues.size();
+    for(int k=0; k<n && !t.first; ++k) {
+        Queue &Q = *queues[(self+k) % n];
+        std::lock_guard<std::mutex> lock(Q.m);
+        if(Q.q.empty()) continue;
+        if(k == 0) {
+            t = std::move(Q.q.back());
+            Q.q.pop_back();
+        } else {
+            t = std::move(Q.q.front());
+            Q.q.pop_front();
+        }
+    }
+    if(!t.first) return false;
+    --queued;
+    try {
+        t.second();
+    } catch(...) {
+        TaskGroup &g = *t.first;
+        std::lock_guard<std::mutex> lock(g.m);
+        if(!g.error) g.error = std::current_exception();
+    }
+    --t.first->pending;
+    return true;
+}
+
+void Pool::wait(TaskGroup &g) {
+    while(g.pending > 0) {
+        if(!run_one()) std::this_thread::yield();
+    }
+    std::exception_ptr e;
+    {
+        std::lock_guard<std::mutex> lock(g.m);
+        std::swap(e, g.error);
+    }
+    if(e) std::rethrow_exception(e);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** Tasks spawned together, joined by Pool::wait.
+ *  The first exception thrown by one of them is kept in `error`,
+ *  and rethrown by wait.
+ */
+struct TaskGroup {
+    std::atomic<long> pending{0};
+    std::mutex m;
+    std::exception_ptr error;
+};
+
+/** Work-stealing thread pool.
+ *
+ *  Every thread (including the one that created the pool) owns
+ *  a deque of tasks.  Spawned tasks go to the back of the current
+ *  thread's deque, and are run from the back by their owner, or
+ *  stolen from the front by idle threads.  A thread waiting for a
+ *  TaskGroup runs tasks meanwhile, so nested fork/join cannot
+ *  deadlock.
+ */
+struct Pool {
+    using Task = std::function<void()>;
+
+    // nthreads includes the calling thread.
+    explicit Pool(int nthreads);
+    ~Pool();
+
+    void spawn(TaskGroup &g, Task f);
+    void wait(TaskGroup &g);
+    int size() const { return queues.size(); }
+
+    static thread_local Pool *cur; ///< pool of the current thread
+
+  private:
+    struct Queue {
+        std::mutex m;
+        std::deque<std::pair<TaskGroup *, Task>> q;
+    };
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<bool> done{false};
+    // Idle workers sleep on `idle` until a task is queued.
+    std::atomic<long> queued{0};
+    std::mutex idle_m;
+    std::condition_variable idle;
+
+    static thread_local int self; // index of this thread's queue
+
+    bool run_one();
+    void worker(int i);
+};
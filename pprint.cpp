@@ -1,5 +1,14 @@
 #include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
 #include "ast.hpp"
+#include "stack.hpp"
+#include "unwind.hpp"
+#include "profile.hpp"
 
 void print_indent(std::ostream &os, int n) {
     static const char spaces[32] = "                               ";
@@ -7,7 +16,16 @@ void print_indent(std::ostream &os, int n) {
     os << "\n" << spaces+31-n;
 }
 
-void print_group(std::ostream &os, AstP g, int indent) {
+// Shared nodes, numbered by print_dag (null: print as a tree).
+using DagNames = std::unordered_map<const Ast *, int>;
+
+static void print_ast(std::ostream &os, AstP a, int indent,
+                      const DagNames *names);
+static void print_node(std::ostream &os, AstP a, int indent,
+                       const DagNames *names);
+
+void print_group(std::ostream &os, AstP g, int indent,
+                 const DagNames *names) {
     if(g->t == Type::top || g->t == Type::Top) {
         return;
     }
@@ -18,50 +36,74 @@ void print_group(std::ostream &os, AstP g, int indent) {
     } else {
         os << " =  ";
     }
-    print_ast(os, g->child[0], indent);
-    print_group(os, g->child[1], indent);
+    print_ast(os, g->child[0], indent, names);
+    print_group(os, g->child[1], indent, names);
 }
 
 void print_ast(std::ostream &os, AstP a, int indent) {
+    PROFILE("print_ast");
+    print_ast(os, a, indent, nullptr);
+}
+
+// Print a, referring to the shared nodes in names as $k.
+static void print_ast(std::ostream &os, AstP a, int indent,
+                      const DagNames *names) {
+    if(names) {
+        auto it = names->find(a.get());
+        if(it != names->end()) {
+            os << "$" << it->second;
+            return;
+        }
+    }
+    print_node(os, a, indent, names);
+}
+
+// Print the node a itself, even if it is shared.
+static void print_node(std::ostream &os, AstP a, int indent,
+                       const DagNames *names) {
     // TODO: print with errors, underlining if a->err is present.
     switch(a->t) {
     case Type::Var:    // type variables, X
-        os << ":" << a->n;
-        break;
+        os << ":";
+        [[fallthrough]];
     case Type::var:     // variables, x
-        os << a->n;
+        if(a->name.size() > 0) { // not numbered, or a TopEnv entry
+            os << a->name;
+        } else {
+            os << a->n;
+        }
         break;
     case Type::Top:    // largest type
         os << "Top";
         break;
     case Type::Fn:     // function spaces, A->B
         os << "(";
-        print_ast(os, a->child[0], indent);
+        print_ast(os, a->child[0], indent, names);
         os << ") ->";
-        print_ast(os, a->child[1], indent);
+        print_ast(os, a->child[1], indent, names);
         break;
     case Type::ForAll:  // bounded quantification, All(X<:A) B
         os << "All(" << a->name << "<: ";
-        print_ast(os, a->child[0], indent);
+        print_ast(os, a->child[0], indent, names);
         os << ") -> ";
-        print_ast(os, a->child[1], indent);
+        print_ast(os, a->child[1], indent, names);
         break;
     case Type::fn:      // functions, fn(x:A) b
         os << "fn(" << a->name << ":";
-        print_ast(os, a->child[0], indent);
+        print_ast(os, a->child[0], indent, names);
         os << ") -> ";
-        print_ast(os, a->child[1], indent);
+        print_ast(os, a->child[1], indent, names);
         break;
     case Type::fnT:     // polymorphic function, fn(X<:A) b
         os << "fn(" << a->name << "<:";
-        print_ast(os, a->child[0], indent);
+        print_ast(os, a->child[0], indent, names);
         os << ") -> ";
-        print_ast(os, a->child[1], indent);
+        print_ast(os, a->child[1], indent, names);
         break;
     case Type::Group:  // grouping, {A}
     case Type::group:   // grouping, {a}
         os << "{";
-        print_group(os, a, indent+4);
+        print_group(os, a, indent+4, names);
         print_indent(os, indent);
         os << "}";
         print_indent(os, indent);
@@ -72,32 +114,306 @@ void print_ast(std::ostream &os, AstP a, int indent) {
     case Type::app:     // application, b(a)
         if(a->child[0]->t == Type::fn) {
             os << "let " << a->name << ":(";
-            print_ast(os, a->child[0]->child[0], indent+2);
+            print_ast(os, a->child[0]->child[0], indent+2, names);
             os << ") = ";
-            print_ast(os, a->child[1], indent+2);
+            print_ast(os, a->child[1], indent+2, names);
             print_indent(os, indent); os << "  in ";
-            print_ast(os, a->child[0]->child[1], indent+4);
+            print_ast(os, a->child[0]->child[1], indent+4, names);
         } else {
             os << "(";
-            print_ast(os, a->child[0], indent);
+            print_ast(os, a->child[0], indent, names);
             os << ") ";
-            print_ast(os, a->child[1], indent);
+            print_ast(os, a->child[1], indent, names);
         }
         break;
     case Type::appT:    // type application, b(:A)
          if(a->child[0]->t == Type::fnT) {
             os << "Let " << a->name << "<:(";
-            print_ast(os, a->child[0]->child[0], indent+2);
+            print_ast(os, a->child[0]->child[0], indent+2, names);
             os << ") =";
-            print_ast(os, a->child[1], indent+2);
+            print_ast(os, a->child[1], indent+2, names);
             print_indent(os, indent); os << "  in ";
-            print_ast(os, a->child[0]->child[1], indent+4);
+            print_ast(os, a->child[0]->child[1], indent+4, names);
         } else {
             os << "(";
-            print_ast(os, a->child[0], indent);
+            print_ast(os, a->child[0], indent, names);
             os << "): ";
-            print_ast(os, a->child[1], indent);
+            print_ast(os, a->child[1], indent, names);
         }
         break;
     }
 }
+
+/* Hash-consing for print_dag.  Structurally equal sub-trees
+ * get the same id, whether or not they are shared in memory.
+ */
+struct DagCount {
+    using Key = std::tuple<int, bool, intptr_t, std::string, int, int>;
+    struct KeyHash {
+        size_t operator()(const Key &k) const {
+            size_t h = std::hash<std::string>()(std::get<3>(k));
+            h = h*31 + std::get<0>(k)*2 + std::get<1>(k);
+            h = h*31 + std::hash<intptr_t>()(std::get<2>(k));
+            h = h*31 + std::get<4>(k);
+            return h*31 + std::get<5>(k);
+        }
+    };
+    std::unordered_map<Key, int, KeyHash> cons;
+    std::unordered_map<const Ast *, int> id;
+    std::vector<int> uses;     // indexed by id
+    std::vector<AstP> order;   // one node per id, in pre-order
+
+    int intern(AstP a) {
+        auto it = id.find(a.get());
+        if(it != id.end()) return it->second;
+        int c[2] = {-1, -1};
+        for(int i=0; i<getNChild(a->t); ++i) {
+            c[i] = intern(a->child[i]);
+        }
+        Key k((int)a->t, a->isPtr, a->n, a->name, c[0], c[1]);
+        int i = cons.emplace(k, cons.size()).first->second;
+        id.emplace(a.get(), i);
+        return i;
+    }
+    // Count references to each id, listing them in pre-order.
+    void count(AstP a) {
+        int i = id[a.get()];
+        if((int)uses.size() <= i) uses.resize(i+1, 0);
+        if(++uses[i] > 1) return;
+        order.push_back(a);
+        for(int j=0; j<getNChild(a->t); ++j) {
+            count(a->child[j]);
+        }
+    }
+};
+
+/** Print a as a DAG.
+ *
+ *  Sub-trees that occur more than once (shared in memory or
+ *  just structurally equal) are printed once, as `where $k = ...`
+ *  after the root, and as `$k` at every use.  The output is then
+ *  linear in the number of distinct sub-trees.  Without repeated
+ *  sub-trees, the output matches print_ast.
+ */
+void print_dag(std::ostream &os, AstP a, int indent) {
+    PROFILE("print_dag");
+    DagCount D;
+    D.intern(a);
+    D.count(a);
+
+    std::vector<int> name(D.cons.size(), 0); // by id
+    int k = 0;
+    for(const AstP &x : D.order) {
+        // Leaves are as short as their names.  Group chains
+        // are printed in line by print_group.
+        int i = D.id[x.get()];
+        if(D.uses[i] > 1 && getNChild(x->t) > 0
+                && x->t != Type::group && x->t != Type::Group) {
+            name[i] = ++k;
+        }
+    }
+    DagNames names;
+    for(auto &p : D.id) {
+        if(name[p.second] > 0) names.emplace(p.first, name[p.second]);
+    }
+
+    print_ast(os, a, indent, &names);
+    for(const AstP &x : D.order) {
+        int i = name[D.id[x.get()]];
+        if(i == 0) continue;
+        print_indent(os, indent+2);
+        os << "where $" << i << " = ";
+        print_node(os, x, indent+4, &names);
+    }
+}
+
+/* Buffered output for print_stack.  Once the size budget
+ * runs out, "..." is written and everything after is dropped.
+ */
+struct Writer {
+    std::ostream &os;
+    char buf[4096];
+    size_t len = 0;
+    bool cut = false;
+
+    Writer(std::ostream &_os) : os(_os) {}
+    ~Writer() { flush(); }
+
+    void flush() {
+        os.write(buf, len);
+        len = 0;
+    }
+    void put(const char *s, size_t n) {
+        if(cut) return;
+        if(len + n > sizeof(buf)) {
+            flush();
+            if(n > sizeof(buf)) {
+                os.write(s, n);
+                return;
+            }
+        }
+        memcpy(buf+len, s, n);
+        len += n;
+    }
+    void put(const char *s) { put(s, strlen(s)); }
+    void put(const std::string &s) { put(s.data(), s.size()); }
+    void put(intptr_t n) {
+        char num[24];
+        put(num, snprintf(num, sizeof(num), "%ld", (long)n));
+    }
+    void indent(int n) {
+        static const char spaces[33] = "\n                               ";
+        put(spaces, 1 + (n < 31 ? n : 31));
+    }
+};
+
+/* Prints a Stack top-down, in the same format as
+ * print_ast(get_ast(s, parent)).
+ *
+ * unwind() visits the head term first and the outermost binder
+ * last, which is the reverse of printing order, so the binders
+ * of each Stack are first collected on `binds` (whose size is
+ * bounded by the binders along one path, not by the output).
+ */
+struct StackPrinter {
+    Writer w;
+    Stack *parent;
+    PrintLimits lim;
+    long nodes = 0;
+    int depth = 0;
+    std::vector<Bind *> binds;
+
+    StackPrinter(std::ostream &os, Stack *_parent, const PrintLimits &_lim)
+        : w(os), parent(_parent), lim(_lim) {}
+
+    // Count one printed node; false if a limit is reached.
+    bool node() {
+        if(w.cut) return false;
+        if(lim.max_size >= 0 && nodes >= lim.max_size) {
+            w.put("...");
+            w.cut = true;
+            return false;
+        }
+        if(lim.max_depth >= 0 && depth >= lim.max_depth) {
+            w.put("...");
+            return false;
+        }
+        ++nodes;
+        return true;
+    }
+
+    void stack(Stack *s, int indent) {
+        if(!node()) return;
+        ++depth;
+        size_t base = binds.size();
+        for(Bind *c = s->ctxt; c != nullptr; c = c->next) {
+            binds.push_back(c);
+        }
+        bind(s, base, binds.size(), indent);
+        binds.resize(base);
+        --depth;
+    }
+
+    // Print binds[base, end) (the last is outermost), then the core.
+    void bind(Stack *s, size_t base, size_t end, int indent) {
+        if(end == base) {
+            core(s, indent);
+            return;
+        }
+        Bind *c = binds[end-1];
+        if(c->rhs == nullptr) {
+            binder(c, indent);
+            bind(s, base, end-1, indent);
+            return;
+        }
+        bool isT = isType(c->rhs->t);
+        if(c->t == (isT ? Type::fnT : Type::fn)) { // let
+            w.put(isT ? "Let <:(" : "let :(");
+            stack(c->rht, indent+2);
+            w.put(isT ? ") =" : ") = ");
+            stack(c->rhs, indent+2);
+            w.indent(indent); w.put("  in ");
+            bind(s, base, end-1, indent+4);
+            return;
+        }
+        w.put("(");
+        binder(c, indent);
+        bind(s, base, end-1, indent);
+        w.put(isT ? "): " : ") ");
+        stack(c->rhs, indent);
+    }
+
+    // Print the part of a binder preceding its body.
+    void binder(Bind *c, int indent) {
+        switch(c->t) {
+        case Type::Fn:
+            w.put("(");
+            stack(c->rht, indent);
+            w.put(") ->");
+            break;
+        case Type::ForAll:
+            w.put("All("); w.put(c->name.str()); w.put("<: ");
+            stack(c->rht, indent);
+            w.put(") -> ");
+            break;
+        case Type::fn:
+            w.put("fn("); w.put(c->name.str()); w.put(":");
+            stack(c->rht, indent);
+            w.put(") -> ");
+            break;
+        case Type::fnT:
+            w.put("fn("); w.put(c->name.str()); w.put("<:");
+            stack(c->rht, indent);
+            w.put(") -> ");
+            break;
+        default:
+            w.put("?");
+            break;
+        }
+    }
+
+    // Print the head term with its pending applications.
+    void core(Stack *s, int indent) {
+        for(Stack *b = s->app; b != nullptr; b = b->next) {
+            w.put("(");
+        }
+        intptr_t n;
+        switch(s->t) {
+        case Type::Var:
+            w.put(":");
+            [[fallthrough]];
+        case Type::var:
+            if(s->number_var(&n, s->ref, parent)
+                    && s->ref->name.str().size() > 0) {
+                w.put(s->ref->name.str());
+            } else {
+                w.put(n);
+            }
+            break;
+        case Type::Top:
+            w.put("Top");
+            break;
+        case Type::top:
+            w.put("top");
+            break;
+        default:
+            w.put("?");
+            break;
+        }
+        for(Stack *b = s->app; b != nullptr; b = b->next) {
+            w.put(isType(b->t) ? "): " : ") ");
+            stack(b, indent);
+        }
+    }
+};
+
+/** Print s as print_ast(os, get_ast(s)) would, without
+ *  building the Ast.  Output is buffered, and cut off with
+ *  "..." below lim.max_depth nested Stacks or after
+ *  lim.max_size Stacks and binders (negative means no limit).
+ */
+void print_stack(std::ostream &os, Stack *s, const PrintLimits &lim) {
+    PROFILE("print_stack");
+    StackPrinter p(os, s->parent, lim);
+    p.stack(s, 0);
+}
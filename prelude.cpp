@@ -0,0 +1,88 @@
+#include "ast.hpp"
+#include "prelude.hpp"
+
+/* The built-in prelude, built and numbered at compile time.
+ *
+ * A reference to an undefined name is a compile error (see the
+ * static_assert below), and at startup the numbered arena is only
+ * copied into Ast-s.  Type checking still happens at runtime, since
+ * several entries (err1..err3) are deliberately ill-typed examples.
+ */
+
+constexpr int Pair(CAst<512> &P, int A, int B) {
+    int C = P.Var("C");
+    return P.ForAll("C", P.Top(), P.Fn(P.Fn(A, P.Fn(B, C)), C));
+}
+
+constexpr CAst<512> build_prelude() {
+    CAst<512> P;
+    int T = P.Top();
+    int X = P.Var("X");
+    int A = P.Var("A");
+    int B = P.Var("B");
+    int C = P.Var("C");
+    int x = P.var("x");
+    int y = P.var("y");
+    int a = P.var("a");
+    int b = P.var("b");
+    int p = P.var("p");
+    int Bool = P.ForAll("X", T, P.Fn(X, P.Fn(X, X)));
+
+    int Id = P.ForAll("X", T, P.Fn(X, X));
+    int id = P.fnT("X", T, P.fn("x", X, x));
+    int g = P.Group("Id", Id, P.top());
+    g = P.group("id", id, g);
+    g = P.group("err1", P.app(id, P.top()), g);
+    g = P.group("err2", P.ForAll("A", T, P.app(P.appT(id, A), id)), g);
+    g = P.group("err3", P.app(P.appT(id, Id), P.top()), g);
+    g = P.group("id2", P.app(P.appT(id, Id), id), g);
+    g = P.Group("Bool",  Bool, g);
+    g = P.Group("True", P.ForAll("X", T, P.Fn(X, P.Fn(T, X))), g);
+    g = P.Group("False", P.ForAll("X", T, P.Fn(T, P.Fn(X, X))), g);
+    g = P.group("true", P.fnT("X", T, P.fn("x",X,P.fn("y",X,x))), g);
+    g = P.group("false", P.fnT("X", T, P.fn("x",X,P.fn("y",X,y))), g);
+    g = P.group("tt", P.fnT("X", T, P.fn("x",X,P.fn("y",T,x))), g);
+    g = P.group("ff", P.fnT("X", T, P.fn("x",T,P.fn("y",X,y))), g);
+    g = P.group("cond", P.fnT("X", T, P.fn("b",Bool,P.appT(P.var("b"),X))), g);
+
+    int Pr = Pair(P, A, B);
+    int pair = P.fnT("A", T, P.fnT("B", T, P.fn("a", A, P.fn("b", B,
+                            P.fnT("C", T,
+                                P.fn("p", P.Fn(A, P.Fn(B, C)),
+                                        P.app(P.app(p, a), b)))
+                            ))));
+    /*int pairT = P.ForAll("A", T, P.ForAll("B", T, P.Fn(A, P.Fn(B, pair(A,B)))));
+    int fstT  = P.ForAll("A", T, P.ForAll("B", T, P.Fn(Pr, A)));
+    int sndT  = P.ForAll("A", T, P.ForAll("B", T, P.Fn(Pr, B)));*/
+    g = P.group("pair", pair, g);
+    g = P.group("fst", P.fnT("A", T, P.fnT("B", T, P.fn("p", Pr,
+                        P.app(P.appT(p, A), P.fn("a",A,P.fn("b",B,a)))
+                   ))), g);
+    g = P.group("snd", P.fnT("A", T, P.fnT("B", T, P.fn("p", Pr,
+                        P.app(P.appT(p, B), P.fn("a",A,P.fn("b",B,b)))
+                   ))), g);
+    int once = P.fnT("A",T,P.fn("f", P.Fn(A, A),
+                                P.fn("x",A, P.app(P.var("f"),x) )));
+    g = P.group("once", once, g);
+    int twice = P.fnT("A",T,P.fn("f", P.Fn(A, A),
+                           P.fn("x", A,
+                               P.app(P.var("f"), P.app(P.var("f"), x))) ));
+    // TODO: improve error message for:
+                               //P.app(P.app(P.var("f"), x), x)) ));
+    g = P.group("twice", twice, g);
+    g = P.group("id1x", P.app(P.app(P.appT(once,Id), P.appT(id,Id)), id), g);
+    g = P.group("id2x", P.app(P.app(P.appT(twice,Id), P.appT(id,Id)), id), g);
+
+    P.root = g;
+    return P;
+}
+
+static constexpr CAst<512> named_prelude = build_prelude();
+static constexpr CAst<512> numbered_prelude = numbered(named_prelude);
+static_assert(named_prelude.ok, "Prelude does not fit in its arena.");
+static_assert(numbered_prelude.ok,
+              "Prelude refers to an undefined variable.");
+
+AstP prelude() {
+    return load_cast(numbered_prelude);
+}
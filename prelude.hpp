@@ -0,0 +1,173 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ast.hpp"
+
+/** Compile-time Ast arena.
+ *
+ *  Nodes refer to their children by index, so an arena can be
+ *  built, numbered and checked in a constexpr function, and the
+ *  result embedded in the binary.  Indices may be shared (DAGs),
+ *  just like AstP children.
+ */
+struct CNode {
+    Type t = Type::Top;
+    const char *name = ""; // string literal
+    int child[2] = {-1, -1};
+    intptr_t n = -1;       // de-Bruijn index, after numbering
+};
+
+template <size_t N>
+struct CAst {
+    CNode node[N] = {};
+    int size = 0;
+    int root = -1;
+    // Set by number() if the Ast refers to an undefined name.
+    bool ok = true;
+    const char *undefined = "";
+
+    constexpr int add(Type t, const char *name = "", int c0 = -1,
+                      int c1 = -1) {
+        if(size >= (int)N) { // arena too small
+            ok = false;
+            return -1;
+        }
+        CNode &x = node[size];
+        x.t = t;
+        x.name = name;
+        x.child[0] = c0;
+        x.child[1] = c1;
+        return size++;
+    }
+
+    // Builders, mirroring the AstP helpers in ast.hpp.
+    constexpr int Var(const char *x)    { return add(Type::Var, x); }
+    constexpr int var(const char *x)    { return add(Type::var, x); }
+    constexpr int Top()                 { return add(Type::Top); }
+    constexpr int top()                 { return add(Type::top); }
+    constexpr int Fn(int A, int B)      { return add(Type::Fn, "", A, B); }
+    constexpr int ForAll(const char *X, int A, int B) {
+        return add(Type::ForAll, X, A, B);
+    }
+    constexpr int fn(const char *x, int A, int b) {
+        return add(Type::fn, x, A, b);
+    }
+    constexpr int fnT(const char *X, int A, int b) {
+        return add(Type::fnT, X, A, b);
+    }
+    constexpr int app(int a, int b)     { return add(Type::app, "", a, b); }
+    constexpr int appT(int a, int B)    { return add(Type::appT, "", a, B); }
+    constexpr int group(const char *x, int a, int g) {
+        return add(Type::group, x, a, g);
+    }
+    constexpr int Group(const char *x, int A, int g) {
+        return add(Type::Group, x, A, g);
+    }
+};
+
+namespace cast {
+
+constexpr bool same_name(const char *a, const char *b) {
+    while(*a != '\0' && *a == *b) {
+        ++a;
+        ++b;
+    }
+    return *a == *b;
+}
+
+/* Constexpr version of numberAst.
+ *
+ * Copies the tree rooted at src.root into dst, replacing
+ * variable names by de-Bruijn indices.  Like numberAst, every
+ * occurrence of a shared sub-tree gets its own copy, since its
+ * indices depend on the binders above it.
+ */
+template <size_t N>
+struct Numbering {
+    static constexpr int max_depth = 128;
+    const CAst<N> &src;
+    CAst<N> &dst;
+    const char *scope[max_depth] = {};
+    int depth = 0;
+
+    constexpr Numbering(const CAst<N> &_src, CAst<N> &_dst)
+        : src(_src), dst(_dst) {}
+
+    constexpr int lookup(const char *name) const {
+        for(int i=depth-1; i>=0; --i) {
+            if(same_name(scope[i], name)) return depth-1-i;
+        }
+        return -1;
+    }
+
+    constexpr int number(int i) {
+        const CNode &x = src.node[i];
+        if(x.t == Type::Var || x.t == Type::var) {
+            int y = dst.add(x.t);
+            if(y < 0) return y;
+            dst.node[y].n = lookup(x.name);
+            if(dst.node[y].n < 0 && dst.ok) {
+                dst.ok = false;
+                dst.undefined = x.name;
+            }
+            return y;
+        }
+        int nchild = getNChild(x.t);
+        if(nchild == 0) return dst.add(x.t);
+
+        int c0 = number(x.child[0]);
+        int c1 = -1;
+        if(isBind(x.t)) {
+            if(depth >= max_depth) {
+                dst.ok = false;
+                return -1;
+            }
+            scope[depth++] = x.name;
+            c1 = number(x.child[1]);
+            --depth;
+        } else {
+            c1 = number(x.child[1]);
+        }
+        // As in numberAst, only group names are kept.
+        bool isGroup = x.t == Type::group || x.t == Type::Group;
+        return dst.add(x.t, isGroup ? x.name : "", c0, c1);
+    }
+};
+
+} // namespace cast
+
+/** Number an arena at compile time.
+ *  Check the `ok` member of the result (e.g. in a static_assert).
+ */
+template <size_t N>
+constexpr CAst<N> numbered(const CAst<N> &src) {
+    CAst<N> dst;
+    if(!src.ok || src.root < 0) {
+        dst.ok = false;
+        return dst;
+    }
+    cast::Numbering<N> num(src, dst);
+    dst.root = num.number(src.root);
+    return dst;
+}
+
+/** Convert a numbered arena into an Ast, preserving sharing. */
+template <size_t N>
+AstP load_cast(const CAst<N> &img) {
+    AstP loaded[N];
+    for(int i=0; i<img.size; ++i) {
+        const CNode &x = img.node[i];
+        AstP y = std::make_shared<Ast>(x.t, x.name);
+        y->n = x.n;
+        for(int j=0; j<getNChild(x.t); ++j) {
+            y->child[j] = loaded[x.child[j]]; // children come first
+        }
+        loaded[i] = y;
+    }
+    return loaded[img.root];
+}
+
+// prelude.cpp
+AstP prelude();
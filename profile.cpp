@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "profile.hpp"
+#include "memstat.hpp"
+
+bool Profile::enabled = false;
+thread_local bool Profile::worker = false;
+Profile::Node Profile::root("", nullptr);
+Profile::Node *Profile::cur = &Profile::root;
+
+static double ms(Profile::clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+static void print_node(std::ostream &os, const Profile::Node *n, int indent) {
+    Profile::clock::duration self = n->total;
+    for(const Profile::Node *c : n->child) {
+        self -= c->total;
+    }
+    char line[128];
+    snprintf(line, sizeof(line), "%*s%-*s %10.3f %10.3f %8ld\n",
+             indent, "", 24-indent, n->name,
+             ms(n->total), ms(self), n->calls);
+    os << line;
+    for(const Profile::Node *c : n->child) {
+        print_node(os, c, indent+2);
+    }
+}
+
+/** Print the call tree collected since the last reset(),
+ *  with total and self times in milliseconds.
+ */
+void Profile::print(std::ostream &os) {
+    char line[128];
+    snprintf(line, sizeof(line), "  %-22s %10s %10s %8s\n",
+             "Profile", "total ms", "self ms", "calls");
+    os << line;
+    for(const Node *c : root.child) {
+        print_node(os, c, 2);
+    }
+}
+
+bool Trace::enabled = false;
+
+namespace {
+
+// Buffered writer for the trace file.
+struct TraceFile {
+    FILE *f = nullptr;
+    char buf[1 << 16];
+    size_t len = 0;
+    bool first = true; // no comma before the first event
+    Profile::clock::time_point t0;
+    // Node counts at each open span, innermost last.
+    std::vector<std::pair<long, long>> open;
+
+    void flush() {
+        fwrite(buf, 1, len, f);
+        len = 0;
+    }
+    // Room for one event, with a name of at most n bytes.
+    void reserve(size_t n) {
+        if(len + n + 256 > sizeof(buf)) flush();
+    }
+    void put(const char *s, size_t n) {
+        memcpy(buf+len, s, n);
+        len += n;
+    }
+    void put(const char *s) { put(s, strlen(s)); }
+    // JSON string contents (names are short identifiers,
+    // but are escaped anyway).
+    void put_str(const char *s, size_t n) {
+        for(size_t i=0; i<n; ++i) {
+            if(s[i] == '"' || s[i] == '\\') {
+                buf[len++] = '\\';
+            }
+            buf[len++] = (unsigned char)s[i] < 0x20 ? '?' : s[i];
+        }
+    }
+    // Event header, up to (and including) the timestamp.
+    void event(const char *name, size_t n, char ph) {
+        if(n > 1024) n = 1024;
+        reserve(2*n);
+        put(first ? "\n" : ",\n");
+        first = false;
+        put("{\"name\":\"");
+        put_str(name, n);
+        double us = std::chrono::duration<double, std::micro>(
+                        Profile::clock::now() - t0).count();
+        len += snprintf(buf+len, 64, "\",\"ph\":\"%c\",\"ts\":%.3f", ph, us);
+    }
+};
+
+TraceFile trace;
+
+} // namespace
+
+/** Start writing a trace to fname, and enable tracing. */
+bool Trace::open(const char *fname) {
+    trace.f = fopen(fname, "w");
+    if(trace.f == nullptr) return false;
+    trace.t0 = Profile::clock::now();
+    trace.first = true;
+    trace.open.clear();
+    trace.put("{\"traceEvents\":[");
+    enabled = true;
+    return true;
+}
+
+/** Finish the trace file and disable tracing. */
+void Trace::close() {
+    if(trace.f == nullptr) return;
+    enabled = false;
+    trace.reserve(0);
+    trace.put("\n]}\n");
+    trace.flush();
+    fclose(trace.f);
+    trace.f = nullptr;
+}
+
+void Trace::begin(const char *name) {
+    trace.event(name, strlen(name), 'B');
+    trace.len += snprintf(trace.buf+trace.len, 96,
+                    ",\"pid\":1,\"tid\":1,\"args\":{\"depth\":%zu}}",
+                    trace.open.size());
+    trace.open.emplace_back(Counted<Stack>::stat.total.load(),
+                            Counted<Ast>::stat.total.load());
+}
+
+void Trace::end(const char *name) {
+    // The span began before Trace::open, or the trace is closed.
+    if(trace.f == nullptr || trace.open.empty()) return;
+    std::pair<long, long> n0 = trace.open.back();
+    trace.open.pop_back();
+    trace.event(name, strlen(name), 'E');
+    trace.len += snprintf(trace.buf+trace.len, 128,
+                    ",\"pid\":1,\"tid\":1,\"args\":"
+                    "{\"stacks\":%ld,\"asts\":%ld}}",
+                    Counted<Stack>::stat.total - n0.first,
+                    Counted<Ast>::stat.total - n0.second);
+}
+
+void Trace::mark(const std::string &name) {
+    if(!enabled) return;
+    trace.event(name.data(), name.size(), 'i');
+    trace.put(",\"s\":\"t\",\"pid\":1,\"tid\":1}");
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/** Hierarchical wall-clock profiler.
+ *
+ *  Each PROFILE("name") scope is timed with a steady clock
+ *  and accumulated into a call tree, keyed by the chain of
+ *  enclosing scope names.  Direct recursion (e.g. get_ast calling
+ *  get_ast) is folded into a single node.
+ *
+ *  Scopes compile to nothing unless FSUB_PROFILE is defined,
+ *  and cost two branches unless Profile::enabled or
+ *  Trace::enabled is set.
+ */
+struct Profile {
+    using clock = std::chrono::steady_clock;
+
+    struct Node {
+        const char *name;  // string literal; compared by address
+        Node *parent;
+        std::vector<Node *> child;
+        clock::duration total{0};
+        long calls = 0;
+        int depth = 0;     // active recursive entries
+        Node(const char *_name, Node *_parent)
+            : name(_name), parent(_parent) {}
+        ~Node() {
+            for(Node *c : child) delete c;
+        }
+        Node *enter(const char *n) {
+            for(Node *c : child) {
+                if(c->name == n) return c;
+            }
+            child.push_back(new Node(n, this));
+            return child.back();
+        }
+    };
+
+    static bool enabled;
+    static thread_local bool worker; ///< pool threads are not profiled
+    static Node root;
+    static Node *cur;
+
+    // Clear all timings (between group entries).
+    static void reset() {
+        for(Node *c : root.child) delete c;
+        root.child.clear();
+        cur = &root;
+    }
+    static void print(std::ostream &os);
+};
+
+/** Chrome trace-event export (--trace).
+ *
+ *  While a trace is open, every PROFILE scope (including direct
+ *  recursion, which Profile folds) writes a begin and an end event
+ *  to a JSON file that chrome://tracing or Perfetto can load.
+ *  Begin events record the nesting depth; end events record the
+ *  number of Stack and Ast nodes constructed within the span.
+ *  Events are written through a buffer.  Like Profile, only the
+ *  main thread is traced.
+ */
+struct Trace {
+    static bool enabled;
+
+    // Returns false if the file could not be opened.
+    static bool open(const char *fname);
+    static void close();
+    static void begin(const char *name);
+    static void end(const char *name);
+    // Instant event, marking e.g. the start of a group entry.
+    static void mark(const std::string &name);
+};
+
+struct ProfileScope {
+    Profile::Node *node = nullptr;
+    Profile::clock::time_point t0;
+    const char *trace = nullptr;
+
+    ProfileScope(const char *name) {
+        if(!Profile::enabled && !Trace::enabled) return;
+        if(Profile::worker) return;
+        if(Trace::enabled) {
+            trace = name;
+            Trace::begin(name);
+        }
+        if(!Profile::enabled) return;
+        Profile::Node *cur = Profile::cur;
+        if(cur->name == name) { // direct recursion
+            ++cur->depth;
+            node = cur;
+            return;
+        }
+        node = cur->enter(name);
+        Profile::cur = node;
+        t0 = Profile::clock::now();
+    }
+    ~ProfileScope() {
+        if(trace) Trace::end(trace);
+        if(!node) return;
+        if(node->depth > 0) {
+            --node->depth;
+            return;
+        }
+        node->total += Profile::clock::now() - t0;
+        ++node->calls;
+        Profile::cur = node->parent;
+    }
+};
+
+#ifdef FSUB_PROFILE
+#define PROFILE_CAT2(a, b) a##b
+#define PROFILE_CAT(a, b) PROFILE_CAT2(a, b)
+#define PROFILE(name) ProfileScope PROFILE_CAT(profile_, __LINE__)(name)
+#else
+#define PROFILE(name)
+#endif
@@ -0,0 +1,303 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "server.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static double ms_since(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+static bool read_all(int fd, char *p, size_t n) {
+    while(n > 0) {
+        ssize_t k = recv(fd, p, n, 0);
+        if(k < 0 && errno == EINTR) continue;
+        if(k <= 0) return false;
+        p += k;
+        n -= k;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const char *p, size_t n) {
+    while(n > 0) {
+        // MSG_NOSIGNAL: a closed peer is an error, not a SIGPIPE.
+        ssize_t k = send(fd, p, n, MSG_NOSIGNAL);
+        if(k < 0 && errno == EINTR) continue;
+        if(k <= 0) return false;
+        p += k;
+        n -= k;
+    }
+    return true;
+}
+
+bool read_frame(int fd, std::string &msg) {
+    uint32_t len;
+    if(!read_all(fd, (char *)&len, sizeof(len))) return false;
+    len = ntohl(len);
+    if(len > max_frame) return false;
+    msg.resize(len);
+    return read_all(fd, &msg[0], len);
+}
+
+bool write_frame(int fd, const std::string &msg) {
+    if(msg.size() > max_frame) return false;
+    uint32_t len = htonl(msg.size());
+    return write_all(fd, (const char *)&len, sizeof(len))
+        && write_all(fd, msg.data(), msg.size());
+}
+
+// Fill in the address of path.  Returns false if it is too long.
+static bool socket_addr(const std::string &path, struct sockaddr_un &addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path.c_str());
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size()+1);
+    return true;
+}
+
+// A client connection, with the bytes received but not yet
+// handled, and the responses not yet sent.
+struct Conn {
+    int fd;
+    std::string in, out;
+};
+
+static bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) >= 0;
+}
+
+// Read what is available.  Returns false on EOF or error.
+static bool fill(Conn &c) {
+    char buf[1 << 16];
+    while(true) {
+        ssize_t k = recv(c.fd, buf, sizeof(buf), 0);
+        if(k > 0) {
+            c.in.append(buf, k);
+            continue;
+        }
+        if(k < 0 && errno == EINTR) continue;
+        return k < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+}
+
+// Send what the socket accepts.  Returns false on error.
+static bool flush(Conn &c) {
+    size_t done = 0;
+    while(done < c.out.size()) {
+        ssize_t k = send(c.fd, c.out.data() + done, c.out.size() - done,
+                         MSG_NOSIGNAL);
+        if(k > 0) {
+            done += k;
+            continue;
+        }
+        if(k < 0 && errno == EINTR) continue;
+        if(k < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        return false;
+    }
+    c.out.erase(0, done);
+    return true;
+}
+
+/* Take the next complete frame out of c.in.  Returns 1 if msg
+ * was filled in, 0 if the frame is incomplete, and -1 if it
+ * is too long.
+ */
+static int next_frame(Conn &c, std::string &msg) {
+    uint32_t len;
+    if(c.in.size() < sizeof(len)) return 0;
+    memcpy(&len, c.in.data(), sizeof(len));
+    len = ntohl(len);
+    if(len > max_frame) return -1;
+    if(c.in.size() < sizeof(len) + len) return 0;
+    msg.assign(c.in, sizeof(len), len);
+    c.in.erase(0, sizeof(len) + len);
+    return 1;
+}
+
+static void add_frame(std::string &out, const std::string &msg) {
+    uint32_t len = htonl(msg.size());
+    out.append((const char *)&len, sizeof(len));
+    out.append(msg);
+}
+
+int serve(std::ostream &os, const std::string &path, const Handler &handle) {
+    struct sockaddr_un addr;
+    if(!socket_addr(path, addr)) return 1;
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if(lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+               || listen(lfd, 64) < 0 || !set_nonblocking(lfd)) {
+        perror(path.c_str());
+        if(lfd >= 0) close(lfd);
+        return 1;
+    }
+    os << "Serving on " << path << std::endl;
+
+    // fds[0] accepts connections, fds[i] polls conns[i-1].
+    std::vector<struct pollfd> fds = {{lfd, POLLIN, 0}};
+    std::vector<Conn> conns;
+    long nreq = 0;
+    bool running = true;
+    while(running) {
+        if(poll(fds.data(), fds.size(), -1) < 0) {
+            if(errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+        if(fds[0].revents & POLLIN) {
+            int c;
+            while((c = accept(lfd, nullptr, nullptr)) >= 0) {
+                if(!set_nonblocking(c)) {
+                    close(c);
+                    continue;
+                }
+                fds.push_back({c, POLLIN, 0});
+                conns.push_back({c, "", ""});
+            }
+        }
+        for(size_t i=1; i<fds.size() && running; ++i) {
+            if(fds[i].revents == 0) continue;
+            Conn &c = conns[i-1];
+            bool ok = true;
+            if(fds[i].revents & POLLOUT) ok = flush(c);
+            // On EOF, still answer the frames that did arrive.
+            bool open = true;
+            if(ok && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                open = fill(c);
+            }
+            std::string msg;
+            int r;
+            while(ok && running && (r = next_frame(c, msg)) != 0) {
+                if(r < 0 || msg.size() == 0) { // a bad frame
+                    ok = false;
+                    break;
+                }
+                auto t0 = Clock::now();
+                char op = msg[0];
+                std::string resp;
+                if(op == 'q') {
+                    running = false;
+                } else {
+                    resp = handle(op, msg.substr(1));
+                }
+                double ms = ms_since(t0);
+                char line[64];
+                if(op != 'q') {
+                    snprintf(line, sizeof(line), "served in %.3f ms\n", ms);
+                    resp += line;
+                }
+                add_frame(c.out, resp);
+                snprintf(line, sizeof(line), "#%ld %c %zu bytes: %s, %.3f ms\n",
+                         ++nreq, op, msg.size()-1,
+                         op == 'q' ? "stop" : resp[0] == '0' ? "ok" : "failed",
+                         ms);
+                os << line << std::flush;
+            }
+            ok = ok && flush(c);
+            if(!running) { // the stop request waits for its response
+                fcntl(c.fd, F_SETFL, fcntl(c.fd, F_GETFL, 0) & ~O_NONBLOCK);
+                flush(c);
+            }
+            if(!ok || !open) {
+                close(c.fd);
+                fds[i].fd = -1;
+            } else {
+                fds[i].events = c.out.empty() ? POLLIN : POLLIN | POLLOUT;
+            }
+        }
+        for(size_t i=fds.size(); i-- > 1; ) {
+            if(fds[i].fd < 0) {
+                fds.erase(fds.begin() + i);
+                conns.erase(conns.begin() + (i-1));
+            }
+        }
+    }
+    for(auto &p : fds) if(p.fd >= 0) close(p.fd);
+    unlink(path.c_str());
+    return 0;
+}
+
+int connect_server(const std::string &path) {
+    struct sockaddr_un addr;
+    if(!socket_addr(path, addr)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) return -1;
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool request(int fd, char op, const std::string &text, std::string &response) {
+    return write_frame(fd, op + text) && read_frame(fd, response);
+}
+
+long load_test(std::ostream &os, const std::string &path, char op,
+               const std::string &text, long n, int conns) {
+    if(conns < 1) conns = 1;
+    std::vector<std::vector<double> > lat(conns);
+    std::atomic<long> failed{0};
+    std::vector<std::thread> threads;
+    auto t0 = Clock::now();
+    for(int i=0; i<conns; ++i) {
+        long share = n/conns + (i < n%conns);
+        threads.emplace_back([&, i, share]() {
+            int fd = connect_server(path);
+            if(fd < 0) {
+                failed += share;
+                return;
+            }
+            std::string resp;
+            for(long j=0; j<share; ++j) {
+                auto t1 = Clock::now();
+                if(!request(fd, op, text, resp)) {
+                    failed += share-j;
+                    break;
+                }
+                lat[i].push_back(ms_since(t1));
+                if(resp.size() == 0 || resp[0] != '0') ++failed;
+            }
+            close(fd);
+        });
+    }
+    for(auto &t : threads) t.join();
+    double secs = ms_since(t0) / 1000.0;
+
+    std::vector<double> all;
+    for(auto &v : lat) all.insert(all.end(), v.begin(), v.end());
+    std::sort(all.begin(), all.end());
+    char line[128];
+    snprintf(line, sizeof(line),
+             "%ld requests on %d connections in %.3f s, %.1f requests/s,"
+             " %ld failed\n", n, conns, secs, all.size()/secs, failed.load());
+    os << line;
+    if(all.size() > 0) {
+        auto pct = [&](double p) {
+            return all[std::min(all.size()-1, (size_t)(p*all.size()))];
+        };
+        snprintf(line, sizeof(line),
+                 "  latency ms: p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+                 pct(0.5), pct(0.9), pct(0.99), all.back());
+        os << line;
+    }
+    return failed;
+}
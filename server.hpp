@@ -0,0 +1,56 @@
+#pragma once
+
+#include <functional>
+#include <iostream>
+#include <string>
+
+/** Check server on a Unix domain socket.
+ *
+ *  A long-running `main --serve` checks its modules (or the
+ *  prelude) once, and keeps their wound entries in a TopEnv that
+ *  every request may refer to by name.
+ *
+ *  Every message is a frame: a 4-byte length, in network byte
+ *  order, followed by that many bytes.  A request is one op byte
+ *  followed by the text of a module:
+ *    'c'  check every entry (output as for -q),
+ *    'e'  check and evaluate every entry (as for --eval),
+ *    'q'  stop the server (no text, empty response).
+ *  The response is one status byte, '0' if every entry checked
+ *  and '1' otherwise, followed by the output and a line giving
+ *  the time the server spent on the request.
+ *
+ *  Requests are served one at a time, in the order they arrive,
+ *  from any number of connections.  Sockets are non-blocking:
+ *  each connection buffers its input until a whole frame has
+ *  arrived, and its output until the client reads it, so a
+ *  slow client does not hold up the others.
+ */
+
+// Largest frame accepted (anything longer closes the connection).
+constexpr size_t max_frame = 64 << 20;
+
+// Read or write one frame.  Return false on EOF or error.
+bool read_frame(int fd, std::string &msg);
+bool write_frame(int fd, const std::string &msg);
+
+// Response (status byte and output) to one request.
+typedef std::function<std::string(char op, const std::string &text)> Handler;
+
+/** Listen on path (replacing a stale socket) and serve requests
+ *  with handle until a 'q' request.  Logs one line per request
+ *  to os.  Returns 0, or 1 if the socket cannot be opened.
+ */
+int serve(std::ostream &os, const std::string &path, const Handler &handle);
+
+// Connect to a server.  Returns the socket, or -1.
+int connect_server(const std::string &path);
+// Send one request and wait for its response.
+bool request(int fd, char op, const std::string &text, std::string &response);
+
+/** Send n requests (op, text) over conns concurrent connections,
+ *  and print the throughput and latency percentiles to os.
+ *  Returns the number of failed requests.
+ */
+long load_test(std::ostream &os, const std::string &path, char op,
+               const std::string &text, long n, int conns);
@@ -1,8 +1,88 @@
 #include <stdio.h>
+#include <mutex>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
 
 #include "ast.hpp"
 #include "stack.hpp"
 #include "unwind.hpp"
+#include "profile.hpp"
+#include "fuel.hpp"
+#include "image.hpp"
+
+// Locked, since parallel eval_need winds (and names) binders.
+// Map nodes do not move, so entries stay valid until erased.
+namespace {
+struct NameTable {
+    std::mutex m;
+    std::unordered_map<std::string, Name::Refs> names;
+};
+NameTable &name_table() {
+    static NameTable *T = new NameTable; // outlives static Names
+    return *T;
+}
+// Approximate size of a table entry, charged to the MemBudget.
+long entry_bytes(const std::string &name) {
+    return sizeof(std::pair<const std::string, Name::Refs>)
+         + 2*sizeof(void *) + heap_bytes(name);
+}
+} // namespace
+
+Name::Entry *Name::intern(const std::string &name) {
+    NameTable &T = name_table();
+    std::lock_guard<std::mutex> lock(T.m);
+    auto it = T.names.find(name);
+    if(it == T.names.end()) {
+        it = T.names.emplace(std::piecewise_construct,
+                             std::forward_as_tuple(name),
+                             std::forward_as_tuple()).first;
+        it->second.budget = mem_charge(entry_bytes(it->first));
+    }
+    ++it->second.n;
+    return &*it;
+}
+
+/* Drop one reference.  Only the last one takes the lock: the
+ * count goes from 1 to 0 (and the entry is erased) with the
+ * lock held, so intern never finds an entry being erased.
+ */
+void Name::release(Entry *e) {
+    long n = e->second.n.load();
+    while(n > 1) {
+        if(e->second.n.compare_exchange_weak(n, n-1)) return;
+    }
+    NameTable &T = name_table();
+    std::lock_guard<std::mutex> lock(T.m);
+    if(--e->second.n == 0) {
+        mem_refund(e->second.budget, entry_bytes(e->first));
+        T.names.erase(T.names.find(e->first));
+    }
+}
+
+size_t Name::count() {
+    NameTable &T = name_table();
+    std::lock_guard<std::mutex> lock(T.m);
+    return T.names.size();
+}
+
+
+thread_local Fuel *Fuel::cur = nullptr;
+
+/* Spend one step of winding.  When the fuel or memory budget
+ * runs out, an error is recorded and the ErrorList is stopped,
+ * so that winding stops at the same safe points as for a full
+ * ErrorList.
+ */
+static bool wind_fuel(ErrorList &err, Stack *s) {
+    bool oom = over_budget();
+    if(!oom && spend_fuel()) return true;
+    if(!err.full()) {
+        err.stop(s->set_error(oom ? "Out of memory." : "Out of fuel."),
+                 oom ? "out of memory" : "out of fuel");
+    }
+    return false;
+}
 
 // Resolve a name to a de-Bruijn index.
 static int lookup1(const std::string &name, Bind *assoc) {
@@ -15,12 +95,85 @@ static int lookup1(const std::string &name, Bind *assoc) {
     return -1;
 };
 
+Bind *TopEnv::find(const std::string &name) const {
+    auto it = names.find(name);
+    if(it != names.end()) return it->second;
+    if(image) {
+        long k = image->find(name);
+        if(k >= 0) return bind(k);
+    }
+    return parent ? parent->find(name) : nullptr;
+}
+
+Bind *TopEnv::add(const std::string &name, bool isT, Stack *s,
+                  AstP type) const {
+    ErrorList err;
+    Bind *c;
+    if(isT) { // a type alias, like fn(X<:Top) ...
+        c = new Bind(ctxt, Type::fnT, name);
+        c->rht = new Stack(err, nullptr, Top(), true);
+    } else {
+        c = new Bind(ctxt, Type::fn, name);
+        c->rht = new Stack(err, nullptr, type, true);
+    }
+    c->rhs = s; // checked already, so check_rhs is not needed
+    c->borrowed = true; // shared, so never evaluated in place
+    ctxt = c;
+    return c;
+}
+
+Bind *TopEnv::define(const std::string &name, bool isT, Stack *s,
+                     AstP type) {
+    return names[name] = add(name, isT, s, type);
+}
+
+/* Wind image entry k, after the entries it refers to, which
+ * are therefore freed after it.  Throws std::runtime_error
+ * if the image is malformed.
+ */
+Bind *TopEnv::bind(size_t k) const {
+    auto it = bound.find(k);
+    if(it != bound.end()) return it->second;
+    if(!image->ok(k)) {
+        throw std::runtime_error(std::string("image: entry ")
+                                 + image->name(k) + " did not check");
+    }
+    auto resolve = [this](size_t j) { return bind(j); };
+    bool isT = image->isT(k);
+    AstP a = image->term(k, resolve);
+    AstP t = image->type(k, resolve);
+    ErrorList err;
+    Stack *s = new Stack(err, nullptr, a, isT);
+    if(!err.ok()) {
+        stack_dtor(s);
+        throw std::runtime_error(std::string("image: entry ")
+                                 + image->name(k) + " does not wind");
+    }
+    Bind *c = add(image->name(k), isT, s, t);
+    bound[k] = c;
+    return c;
+}
+
+TopEnv::~TopEnv() {
+    // Later entries refer to earlier ones, so free them first.
+    while(ctxt != nullptr) {
+        Bind *c = ctxt;
+        ctxt = c->next;
+        stack_dtor(c->rhs);
+        stack_dtor(c->rht);
+        delete c;
+    }
+}
+
 // Traverse x and number all named Var-s.
 // Replaces x with a numbered Ast.
 //
 // We use a hacked Bind chain here to track binding depth
 // but a linked-list with names would work just as well.
-void numberAst(ErrorList &err, AstP *x, Bind *assoc) {
+// Names not bound in x are looked up in env, and become
+// pointer variables to its Binds.
+void numberAst(ErrorList &err, AstP *x, Bind *assoc, const TopEnv *env) {
+    PROFILE("numberAst");
     Bind *const first = assoc;
     while(true) {
         AstP y = std::make_shared<Ast>((*x)->t);
@@ -29,8 +182,13 @@ void numberAst(ErrorList &err, AstP *x, Bind *assoc) {
         }
         if((*x)->t == Type::Var || (*x)->t == Type::var) {
             y->n = lookup1((*x)->name, assoc);
-            if(y->n < 0) {
-                err.append( y->set_err("Undefined variable.") );
+            Bind *ref = y->n < 0 && env ? env->find((*x)->name) : nullptr;
+            if(ref) {
+                y->isPtr = true;
+                y->n = (intptr_t)ref;
+                y->name = (*x)->name;
+            } else if(y->n < 0) {
+                err.append( y->set_err("Undefined variable " + (*x)->name + ".") );
             }
             *x = y;
             break;
@@ -45,7 +203,7 @@ void numberAst(ErrorList &err, AstP *x, Bind *assoc) {
 
         // Generic recursion over first nchild-1 binders.
         for(int i=0; i<nchild-1; ++i) {
-            numberAst(err, &y->child[i], assoc);
+            numberAst(err, &y->child[i], assoc, env);
         }
         // The last child of a binding contains the binding.
         if(isBind((*x)->t)) {
@@ -223,6 +381,7 @@ bool Stack::deref(AstP a, bool initial) {
 
 Stack::Stack(ErrorList &err, Stack *_p, AstP a, bool isT, Stack *_next)
         : parent(_p), ctxt(nullptr), app(nullptr), next(_next) {
+    PROFILE("Stack");
     if(isT) {
         windType(err, a);
     } else {
@@ -264,12 +423,13 @@ struct windStack {
             throw std::runtime_error("Encountered invalid value in wind");
             break;
         }
-        if(!s->err && isType(s->t)) {
+        if(!s->err() && isType(s->t)) {
             err.append(s->set_error("Expected term, but found a type."));
         }
         return nullptr;
     }
     AstP bind(AstP a) {
+        if(err.full() || !wind_fuel(err, s)) return nullptr;
         Stack *rhs = s->app;
         if(a->t != Type::fn && a->t != Type::fnT) {
             err.append(s->set_error("Unexpected type function in term."));
@@ -287,6 +447,7 @@ struct windStack {
         return a->child[1];
     }
     AstP apply(AstP a) {
+        if(err.full() || !wind_fuel(err, s)) return nullptr;
         bool isT = a->t == Type::appT; // Is rhs a type?
         s->app = new Stack(err, s, a->child[1], isT, s->app);
         return a->child[0];
@@ -313,10 +474,14 @@ struct windStackType {
                 ++s->ref->nref;
                 return nullptr;
             }
-            if(s->ref->rhs == nullptr) {
-                ++s->ref->nref; // no known substitition for this type var
+            if(s->ref->rhs == nullptr || (isAlias(s->ref) && !args)
+                                      || !wind_fuel(err, s)) {
+                // a type variable, or an alias, which is kept as a
+                // reference unless it is being applied (or no fuel
+                // left to expand it)
+                ++s->ref->nref;
             } else {
-                return get_ast(s->ref->rhs); // locally nameless Ast
+                return get_ast(s->ref->rhs); // shared, locally nameless
             }
             break;
         case Type::var:    // variables, x
@@ -336,12 +501,14 @@ struct windStackType {
             return nullptr;
         }
         // type = type of bottom term in Ast.
-        if(!s->err && !isType(s->t)) {
+        if(!s->err() && !isType(s->t)) {
             err.append(s->set_error("Expected type, but found a term."));
         }
         return nullptr;
     }
     AstP bind(AstP a) {
+        // out of error budget or fuel
+        if(err.full() || !wind_fuel(err, s)) return nullptr;
         const char err1[] = "Invalid application of type (A->B).";
         const char err2[] = "Invalid application of type All(X:<A) B.";
         Stack *rhs = s->app;
@@ -359,13 +526,21 @@ struct windStackType {
             // ast are no longer fully evaluated at this point.
             //
             AstP rht;
+            bool borrow = false;
             if(a->t == Type::ForAll) {
                 if(!isType(args->t)) {
                     err.append(s->set_error("fnT applied to non-type"));
                     args = nullptr;
                     return nullptr;
                 }
-                rht = get_ast(args);
+                // Bound in place below.  The arguments are the
+                // application list of s->parent (GetType::instantiate),
+                // whose binders they refer to.
+                if(args->parent != s->parent) {
+                    throw std::runtime_error("Type argument bound outside"
+                                             " its parent.");
+                }
+                borrow = true;
             } else if(a->t == Type::Fn) {
                 if(isType(args->t)) {
                     err.append(s->set_error("fn applied to type"));
@@ -383,8 +558,9 @@ struct windStackType {
             // to resolve bindings added during this windType traversal.
             // TODO: use fewer wind/unwind steps.
             Stack *rht_ts = new Stack(err, s, a->child[0], true);
-            AstP rht_t = get_ast(rht_ts);
-            TracebackP tb = subType(rht, rht_t);
+            // A borrowed argument is compared with its bound in place.
+            TracebackP tb = borrow ? subType(args, rht_ts)
+                                   : subType(rht, rht_ts);
             if(tb) {
                 err.append(s->traceback([=](std::ostream &os){
                                os << "Invalid function application.\n";
@@ -393,16 +569,20 @@ struct windStackType {
                 //stack_dtor(rht_ts);
                 //return nullptr;
             }
-            // Note, this effectively copies the stack.
-            // We *might* be able to move args in-place if
-            // we swapped out a place-holder like Top.
-            // However, further get_ast-s would be incorrect.
-            Stack *rhts = new Stack(err, s, rht, true);
+            // A type argument is bound in place, without copying
+            // (Bind::borrowed).  It stays in the application list of
+            // s->parent, whose binders it refers to, so s must be
+            // unwound relative to s->parent while the binder exists.
+            // The type of a term argument has no stack, so it is
+            // wound here.
+            Stack *rhts = borrow ? args : new Stack(err, s, rht, true);
             // rhs is known to be a type, bind it as fnT
             s->ctxt = new Bind(err, s->ctxt, Type::fnT, a->name,
                                rht_ts, nullptr);
             // prevent unification again
             s->ctxt->rhs = rhts;
+            s->ctxt->borrowed = borrow;
+            s->ctxt->param = true;
             args = args->next;
             return a->child[1];
         }
@@ -427,7 +607,7 @@ struct windStackType {
         }
         return a->child[1];
     }
-    AstP apply(AstP a) {
+    AstP apply(AstP) {
         err.append(s->set_error("Invalid application of a type."));
         return nullptr;
     }
@@ -440,10 +620,44 @@ bool Stack::isTrivial() const {
     return isValue(t) && app == nullptr && ctxt == nullptr;
 }
 
+std::atomic<unsigned long> Stack::clock{0};
+thread_local bool Stack::cache_ast = true;
+
+/** Invalidate the cached get_ast of this stack and of every
+ *  stack containing it.
+ *
+ *  A cached stack's sub-stacks are always cached as well, so the
+ *  walk stops at the first stack without one.  It also stops at
+ *  a detached stack, since its parent does not contain it.
+ *  Sub-stacks that were numbered across this stack's binders are
+ *  not visited; get_ast compares their ast_time to `changed`
+ *  instead.
+ */
+void Stack::modified() {
+    unsigned long now = ++clock;
+    if(x) x->changed = now;
+    for(Stack *p = this; p != nullptr && p->x && p->x->ast; p = p->parent) {
+        p->x->ast = nullptr;
+        if(p->detached) break;
+    }
+}
+
+Stack::~Stack() {
+    delete x;
+}
+
+StackExtra &Stack::extra() {
+    if(x == nullptr) x = new StackExtra;
+    return *x;
+}
+
 /** Wind the value `a` onto the stack.
  *  Only types are evaluated.
  */
 void Stack::wind(ErrorList &err, AstP a) {
+    modified();
+    if(x) x->type = nullptr;
+    if(err.full()) return; // leave the stack blank
     windStack W(err, this);
     ::wind(&W, a);
 }
@@ -461,6 +675,10 @@ void Stack::wind(ErrorList &err, AstP a) {
  *  is encountered.
  */
 void Stack::windType(ErrorList &err, AstP a, Stack *app) {
+    PROFILE("windType");
+    modified();
+    if(x) x->type = nullptr;
+    if(err.full()) return; // leave the stack blank
     windStackType W(err, this, app);
     ::wind(&W, a);
     if(W.args) { // args remain after wind
@@ -470,12 +688,19 @@ void Stack::windType(ErrorList &err, AstP a, Stack *app) {
     }
 }
 
+Bind::~Bind() {
+    if(inst) inst_forget(this);
+}
+
 void Bind::check_rhs(ErrorList &err) {
-    if(rhs) {
-        AstP A = get_type(err, rhs);
-        AstP B = get_ast(rht);
+    if(rhs && !err.full()) {
+        // Type arguments are checked against their bound directly
+        // (their get_type is Top, which only fits a Top bound).
+        // Both sides are compared in place, without get_ast.
+        TracebackP tb = isType(rhs->t) ? subType(rhs, rht)
+                                       : subType(get_type(err, rhs), rht);
         err.append(rhs->traceback([=](std::ostream& os) {
                         os << "Invalid argument type.\n";
-               }, subType(A, B)));
+               }, std::move(tb)));
     }
 }
@@ -1,43 +1,135 @@
 #pragma once
 
+#include <atomic>
 #include <string>
+#include <unordered_map>
 #include "error.hpp"
+#include "ast.hpp"
 
 struct Bind;
 struct Stack;
+struct Image;
+
+/** Interned, immutable binder name.
+ *
+ *  Names are for readability only, but a `std::string` per binder
+ *  was over half the size of a Bind.  Interning shrinks that to
+ *  a single pointer into a global string table.  Entries are
+ *  reference counted, and removed with their last Name, so the
+ *  table does not grow over a long-running --serve.  The empty
+ *  name of anonymous binders is a null pointer, and takes no lock.
+ */
+class Name {
+  public:
+    struct Refs {
+        std::atomic<long> n{0};
+        unsigned budget = 0; ///< MemBudget charged for the entry
+    };
+  private:
+    typedef std::pair<const std::string, Refs> Entry;
+    Entry *e; ///< null for the empty name, which is not interned
+    static Entry *intern(const std::string &name);
+    static void release(Entry *e);
+    static const std::string &empty() {
+        static const std::string s;
+        return s;
+    }
+  public:
+    Name() : e(nullptr) {}
+    Name(const std::string &name)
+        : e(name.empty() ? nullptr : intern(name)) {}
+    Name(const Name &n) : e(n.e) { if(e) ++e->second.n; }
+    Name &operator=(const Name &n) {
+        Name tmp(n);
+        std::swap(e, tmp.e);
+        return *this;
+    }
+    ~Name() { if(e) release(e); }
+    operator const std::string &() const { return str(); }
+    const std::string &str() const { return e ? e->first : empty(); }
+    const char *c_str() const { return str().c_str(); }
+    bool operator==(const std::string &name) const { return str() == name; }
+
+    // Number of distinct names in the table.
+    static size_t count();
+};
 
 /** Linked list of variable contexts.
+ *
+ *  Field order keeps the owning budget (Counted), tag and flags
+ *  in one word, and the refcount in the next, so a Bind fits in
+ *  48 bytes (see static_assert below).
  */
-struct Bind {
+struct Bind : Counted<Bind> {
     Type t;
+    bool inst = false; ///< has instantiation cache entries (type.cpp)
+    /** rhs is owned by another stack, and is not freed with this
+     *  Bind or evaluated through it (need_var substitutes a copy).
+     *  Either the rhs is a TopEnv entry, shared by every module
+     *  referring to it, or it is contained in a stack with the
+     *  same parent as the stack holding this Bind, which may then
+     *  only be unwound relative to that parent (get_ast throws
+     *  otherwise) (see windStackType::bind).
+     */
+    bool borrowed = false;
+    /// Parameter of an instantiation (windStackType::bind).  Unlike
+    //  other type binders with a rhs (aliases), references to it
+    //  are expanded when wound.
+    bool param = false;
+    std::atomic<int> nref; // number of references to binding
     Bind *next;
-    std::string name; // for readability only
+    Name name; // for readability only
     Stack *rht; // Note: this could just as easily be an AstP
     Stack *rhs;
-    int nref; // number of references to binding
 
     // "open" binding (denotes function type)
     Bind(Bind *_next, Type _t)
-        : t(_t), next(_next)
-        , rht(nullptr), rhs(nullptr), nref(0) {}
+        : t(_t), nref(0), next(_next)
+        , rht(nullptr), rhs(nullptr) {}
     // "open" named binding (denotes function type)
     Bind(Bind *_next, Type _t, const std::string &_name)
-        : t(_t), next(_next), name(_name)
-        , rht(nullptr), rhs(nullptr), nref(0) {}
+        : t(_t), nref(0), next(_next), name(_name)
+        , rht(nullptr), rhs(nullptr) {}
     // nameless binding with rhs
     Bind(ErrorList &err, Bind *_next, Type _t, Stack *_rht, Stack *_rhs)
-        : t(_t), next(_next)
-        , rht(_rht), rhs(_rhs), nref(0) { check_rhs(err); }
+        : t(_t), nref(0), next(_next)
+        , rht(_rht), rhs(_rhs) { check_rhs(err); }
 
     // named binding
     Bind(ErrorList &err, Bind *_next, Type _t, const std::string &_name,
             Stack *_rht, Stack *_rhs)
-        : t(_t), next(_next)
+        : t(_t), nref(0), next(_next)
         , name(_name)
-        , rht(_rht), rhs(_rhs), nref(0) { check_rhs(err); }
+        , rht(_rht), rhs(_rhs) { check_rhs(err); }
 
+    ~Bind();
     void check_rhs(ErrorList &err);
 };
+static_assert(sizeof(Bind) <= 6*sizeof(void *), "Bind layout grew.");
+
+/** Parts of a Stack that most stacks never use, kept out of line
+ *  so that a wound Stack stays at seven words.
+ *
+ *  Allocated when a stack first records an error, or caches its
+ *  get_type or get_ast, or is spanned by a cached get_ast (see
+ *  unwind.cpp), and freed with the stack.
+ */
+struct StackExtra : Counted<StackExtra> {
+    /// Weak-pointer to traceback. For print only.
+    //  Do not dereference this pointer!
+    Traceback const *err = nullptr;
+    /// Cached result of get_type (locally nameless, like get_ast).
+    //  Cleared whenever the stack is re-wound or evaluated.
+    AstP type;
+    /// Cached get_ast(stack, ast_parent), computed at time ast_time
+    //  (see unwind.cpp).  Cleared by modified().
+    AstP ast;
+    const Stack *ast_parent = nullptr;
+    unsigned long ast_time = 0;
+    /// Time of the last modified(), recorded only once the
+    //  extra exists (no cached get_ast depends on it before).
+    unsigned long changed = 0;
+};
 
 /** Cons cell for an application
  *
@@ -69,29 +161,47 @@ struct Bind {
  * Stack3
  *
  */
-struct Stack {
-    Type t;
+struct Stack : Counted<Stack> {
+    Type t = Type::Top; ///< head term (Top until wound)
+    /// Scratch stack, not contained in its parent (see modified()).
+    bool detached = false;
     Stack *parent;   ///< parent chain for binding location of stack
                      //   (creating a chain of "head" terms)
     Bind *ctxt;      ///< linked list of bindings (local to this stack)
     Stack *app;      ///< linked list of right-hand sides
     Stack *next;     ///< linker for right-hand sides
 
-    Bind *ref;       ///< TVar / var
-    /// Weak-pointer to traceback. For print only.
-    //  Do not dereference this pointer!
-    Traceback const *err = nullptr;
+    Bind *ref = nullptr; ///< TVar / var
+    /// Traceback and caches, allocated on first use (extra()).
+    StackExtra *x = nullptr;
+
+    /// Ticks once per modified() call.
+    static std::atomic<unsigned long> clock;
+    /// Whether get_ast results are cached, per thread.  Off on the
+    //  threads running an eval_need_parallel call, which share stacks.
+    static thread_local bool cache_ast;
 
     // Construct a "blank" stack with nothing on it.
     Stack(Stack *_parent) : parent(_parent), ctxt(nullptr),
                             app(nullptr), next(nullptr) {}
     // Creation of a stack "winds up" the Ast.
     Stack(ErrorList &, Stack *parent, AstP a, bool isT, Stack *next=nullptr);
+    Stack(const Stack &) = delete;
+    Stack &operator=(const Stack &) = delete;
+    ~Stack();
+    StackExtra &extra();
+    /// Weak-pointer to traceback. For print only.
+    //  Do not dereference this pointer!
+    Traceback const *err() const { return x ? x->err : nullptr; }
+    /// Cached get_type, or null.
+    AstP type() const { return x ? x->type : nullptr; }
     // Used during construction of the stack from an Ast.
     Bind *lookup(int n, bool initial=false);
     bool deref(AstP a, bool initial);
     Bind *outer_ctxt() const;
     bool isTrivial() const;
+    // Must be called before changing t, ctxt or app.
+    void modified();
 
     bool number_var(intptr_t *n, Bind *ref, const Stack *parent) const;
     // Used to wind an Ast onto the head term of the stack.
@@ -102,9 +212,9 @@ struct Stack {
      *  throw an error.  Does nothing if no error is present.
      */
     TracebackP traceback(const TBPrint &w, TracebackP &&next) {
-        if(next == nullptr) return next;
+        if(next == nullptr) return nullptr;
         TracebackP tb = mkTB(w, std::move(next));
-        err = tb.get();
+        extra().err = tb.get();
         return tb;
     }
     /** Create an error message and mark the current stack as its source.
@@ -114,10 +224,20 @@ struct Stack {
      */
     TracebackP set_error(const std::string &name) {
         TracebackP tb = mkError(name);
-        err = tb.get();
+        extra().err = tb.get();
         return tb;
     }
 };
+static_assert(sizeof(Stack) <= 7*sizeof(void *), "Stack layout grew.");
+
+/** A type alias: a type binder whose rhs is a type (let-bound,
+ *  or a TopEnv type).  Wound types keep references to aliases,
+ *  and subType and get_type look through them to their rhs.
+ */
+inline bool isAlias(const Bind *c) {
+    return bindType(c->t) && !c->param && c->rhs != nullptr
+        && isType(c->rhs->t);
+}
 
 // Multiple unwind functions are possible.
 template <typename SFold>
@@ -164,4 +284,47 @@ void wind(windFn *F, AstP a) {
     }
 }
 
-void numberAst(ErrorList &err, AstP *x, Bind *assoc = nullptr);
+/** Top-level environment of checked module entries.
+ *
+ *  Each entry that checked becomes a Bind holding its term (or
+ *  type) as rhs and its type as rht.  numberAst resolves the names
+ *  of later entries to these Binds as pointer variables, so they
+ *  are referenced instead of copied.  The Binds are freed last,
+ *  after every Stack referring to them.
+ *
+ *  An environment over an image (see image.hpp) takes its entries
+ *  from there instead.  Each one is wound and added when find first
+ *  reaches it, so find is not thread-safe.
+ *
+ *  Names not defined here are looked up in the parent, which
+ *  must outlive this environment.
+ */
+struct TopEnv {
+    std::unordered_map<std::string, Bind *> names;
+    mutable Bind *ctxt = nullptr; // every entry, latest first
+    const TopEnv *parent = nullptr;
+    Image *image = nullptr;
+
+    TopEnv() {}
+    explicit TopEnv(const TopEnv *_parent) : parent(_parent) {}
+    explicit TopEnv(Image *_image) : image(_image) {}
+    TopEnv(const TopEnv &) = delete;
+    TopEnv &operator=(const TopEnv &) = delete;
+    ~TopEnv();
+
+    Bind *find(const std::string &name) const;
+    /** Add an entry, taking ownership of its wound stack s.
+     *  type is the entry's type (ignored for types, isT).
+     *  Returns its Bind.
+     */
+    Bind *define(const std::string &name, bool isT, Stack *s, AstP type);
+    // Entry k of the image, wound on first use.
+    Bind *bind(size_t k) const;
+
+  private:
+    mutable std::unordered_map<size_t, Bind *> bound; // image entries
+    Bind *add(const std::string &name, bool isT, Stack *s, AstP type) const;
+};
+
+void numberAst(ErrorList &err, AstP *x, Bind *assoc = nullptr,
+               const TopEnv *env = nullptr);
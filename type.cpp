@@ -1,48 +1,221 @@
 #include <stdio.h>
 #include <iostream>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "ast.hpp"
 #include "unwind.hpp"
+#include "profile.hpp"
+#include "fuel.hpp"
 
-TracebackP subType1(AstP A, AstP B);
+// Results of replaceVars for shared nodes, by (node, ndown).
+typedef std::map<std::pair<const Ast *, int>, AstP> VarsMemo;
 
-void replaceVars(AstP a, const std::map<intptr_t,int> &map, int ndown);
-// Replaces pointers with numbers.
-// the map is from [Bind *] to [depth to the term's root]
-struct windReplaceVars {
-    const std::map<intptr_t,int> &map;
-    int ndown;
-    windReplaceVars(const std::map<intptr_t,int> &_map, int _ndown)
-        : map(_map), ndown(_ndown) {}
+static AstP replaceVars(AstP a, const std::map<intptr_t,int> &map,
+                        int ndown, VarsMemo &memo);
 
-    AstP val(AstP a) {
+/** Replace pointers with numbers.
+ *  The map is from [Bind *] to [depth to the term's root].
+ *
+ *  Returns a copy of a, sharing every sub-tree that has no
+ *  replaced variables (a may contain cached get_ast results,
+ *  so it is never modified in place).  Shared sub-trees are
+ *  renumbered once per depth, so a DAG stays a DAG.
+ */
+AstP replaceVars(AstP a, const std::map<intptr_t,int> &map, int ndown) {
+    VarsMemo memo;
+    return replaceVars(a, map, ndown, memo);
+}
+
+static AstP replaceVars1(AstP a, const std::map<intptr_t,int> &map,
+                         int ndown, VarsMemo &memo) {
+    switch(a->t) {
+    case Type::Var:
+    case Type::var:
         if(a->isPtr) {
             auto it = map.find(a->n);
             if(it != map.end()) {
-                a->isPtr = false;
-                a->n = ndown + it->second;
+                AstP y = std::make_shared<Ast>(a->t, a->name);
+                y->n = ndown + it->second;
+                y->err = a->err;
+                return y;
             }
         }
-        return nullptr;
+        return a;
+    default:
+        break;
     }
-    AstP bind(AstP a) {
-        replaceVars(a->child[0], map, ndown);
-        ++ndown;
-        return a->child[1];
-    }
-    AstP apply(AstP a) {
-        replaceVars(a->child[1], map, ndown);
-        return a->child[0];
+    if(getNChild(a->t) == 0) return a;
+    AstP c0 = replaceVars(a->child[0], map, ndown, memo);
+    AstP c1 = replaceVars(a->child[1], map, isBind(a->t) ? ndown+1 : ndown,
+                          memo);
+    if(c0 == a->child[0] && c1 == a->child[1]) return a;
+    AstP y = std::make_shared<Ast>(a->t, a->name, c0, c1);
+    y->n = a->n;
+    y->err = a->err;
+    return y;
+}
+
+static AstP replaceVars(AstP a, const std::map<intptr_t,int> &map,
+                        int ndown, VarsMemo &memo) {
+    if(a.use_count() <= 2) { // only a and its parent refer to it
+        return replaceVars1(a, map, ndown, memo);
     }
+    auto key = std::make_pair((const Ast *)a.get(), ndown);
+    auto it = memo.find(key);
+    if(it != memo.end()) return it->second;
+    AstP y = replaceVars1(a, map, ndown, memo);
+    memo[key] = y;
+    return y;
+}
+
+// Results of expandAliases, by node and by alias.
+struct AliasMemo {
+    std::map<const Ast *, AstP> nodes;
+    std::map<const Bind *, AstP> aliases;
 };
-// Replace local variables with de-Bruijn indices
-// Note: this breaks convention and replaces vars in-place.
-void replaceVars(AstP a, const std::map<intptr_t,int> &map, int ndown) {
-    windReplaceVars W(map, ndown);
-    wind(&W, a);
+
+/** Replace references to aliases (isAlias) with their
+ *  definitions.  Each alias is expanded once, and shared by
+ *  all its uses.  Like replaceVars, a is never modified.
+ */
+static AstP expandAliases(AstP a, AliasMemo &memo) {
+    if(a->t == Type::Var && a->isPtr && isAlias(a->ref())) {
+        Bind *c = a->ref();
+        auto it = memo.aliases.find(c);
+        if(it != memo.aliases.end()) return it->second;
+        AstP y = expandAliases(get_ast(c->rhs), memo);
+        memo.aliases[c] = y;
+        return y;
+    }
+    if(getNChild(a->t) == 0) return a;
+    bool shared = a.use_count() > 2;
+    if(shared) {
+        auto it = memo.nodes.find(a.get());
+        if(it != memo.nodes.end()) return it->second;
+    }
+    AstP c0 = expandAliases(a->child[0], memo);
+    AstP c1 = expandAliases(a->child[1], memo);
+    AstP y = a;
+    if(c0 != a->child[0] || c1 != a->child[1]) {
+        y = std::make_shared<Ast>(a->t, a->name, c0, c1);
+        y->n = a->n;
+        y->err = a->err;
+    }
+    if(shared) memo.nodes[a.get()] = y;
+    return y;
+}
+
+// get_ast(s) with aliases expanded, for printing errors.
+static AstP expanded_ast(Stack *s) {
+    AliasMemo memo;
+    return expandAliases(get_ast(s), memo);
 }
 
+/** Read-only cursor over a completely evaluated type,
+ *  stored either as an Ast or as a wound Stack.
+ *
+ *  A Stack is viewed as its binders (outermost first)
+ *  followed by its head term.  Variables are numbered as
+ *  get_ast(s, base) would number them, so views over Ast-s
+ *  and Stack-s can be compared without unwinding the Stack.
+ *
+ *  References to aliases (isAlias) are looked through: the
+ *  view moves to the alias's rhs, numbered relative to its own
+ *  parent.  An alias is defined outside the type, so everything
+ *  free in its rhs is a pointer either way.
+ *
+ *  Moving a cursor never allocates.  Viewing a Stack with
+ *  several binders collects them (outermost first) once, so
+ *  that each step inward is O(1).  Stacks that are not plain
+ *  types (pending applications or let-bound binders) are
+ *  unwound with get_ast as a fallback.
+ */
+struct TypeView {
+    const Ast *a = nullptr; // Ast cursor
+    AstP own;               // keeps a fallback Ast alive
+    Stack *s = nullptr;     // Stack cursor ...
+    int k = 0;              // ... at its k-th outermost binder
+    int nctx = 0;           // number of binders in s->ctxt
+    // s->ctxt, outermost first (if nctx > 1), shared by copies
+    std::shared_ptr<const std::vector<Bind *>> binders;
+    const Stack *base = nullptr; // numbering base for s
+
+    TypeView(const Ast *_a) : a(_a) {
+        resolve();
+    }
+    TypeView(Stack *_s, const Stack *_base) : base(_base) {
+        bool plain = _s->app == nullptr;
+        int n = 0;
+        for(Bind *c = _s->ctxt; plain && c != nullptr; c = c->next, ++n) {
+            plain = c->rhs == nullptr;
+        }
+        if(!plain) {
+            own = get_ast(_s, const_cast<Stack *>(_base));
+            a = own.get();
+            resolve();
+            return;
+        }
+        s = _s;
+        nctx = n;
+        if(n > 1) {
+            auto v = std::make_shared<std::vector<Bind *>>(n);
+            for(Bind *c = s->ctxt; c != nullptr; c = c->next) {
+                (*v)[--n] = c;
+            }
+            binders = std::move(v);
+        }
+        resolve();
+    }
+
+    // The alias the cursor refers to, if any.
+    Bind *alias() const {
+        if(a) {
+            Bind *c = (Bind *)a->n;
+            return a->t == Type::Var && a->isPtr && isAlias(c) ? c : nullptr;
+        }
+        bool head = k == nctx && s->t == Type::Var;
+        return head && s->ref && isAlias(s->ref) ? s->ref : nullptr;
+    }
+    void resolve() {
+        if(Bind *c = alias()) { // the new view resolves itself
+            *this = TypeView(c->rhs, c->rhs->parent);
+        }
+    }
+
+    // Binder at position k, counting from the outermost.
+    Bind *binder() const {
+        return nctx > 1 ? (*binders)[k] : s->ctxt;
+    }
+    Type t() const {
+        if(a) return a->t;
+        return k < nctx ? binder()->t : s->t;
+    }
+    // Numbering of a variable, as in Ast::isPtr and Ast::n.
+    bool var(intptr_t *n) const {
+        if(a) {
+            *n = a->n;
+            return a->isPtr;
+        }
+        return s->number_var(n, s->ref, base);
+    }
+    TypeView child(int i) const {
+        if(a) return TypeView(a->child[i].get());
+        if(i == 0) return TypeView(binder()->rht, base);
+        TypeView v(*this);
+        ++v.k;
+        v.resolve();
+        return v;
+    }
+};
+
+static TracebackP subType1(const TypeView &A, const TypeView &B);
+
 /** check that A is a subtype of B
  *
  *  Returns a (unique pointer to) Traceback on error,
@@ -52,24 +225,55 @@ void replaceVars(AstP a, const std::map<intptr_t,int> &map, int ndown) {
  *  before entry to this function.
  */
 TracebackP subType(AstP A, AstP B) {
+    PROFILE("subType");
     return mkTB([=](std::ostream& os) {
                 os << "While checking: "; print_ast(os, A, 7);
                 os << "\n  <: "; print_ast(os, B, 7);
                 os << "\n";
-           }, subType1(A, B));
+           }, subType1(TypeView(A.get()), TypeView(B.get())));
+}
+
+/** Check A <: B, where B is a wound type numbered with respect
+ *  to B->parent (i.e. as get_ast(B) would number it).
+ *  B is only unwound if the check fails, to print the error.
+ */
+TracebackP subType(AstP A, Stack *B) {
+    PROFILE("subType");
+    TracebackP err = subType1(TypeView(A.get()), TypeView(B, B->parent));
+    if(!err) return err;
+    return subType(A, expanded_ast(B)); // re-run to build the message
+}
+
+/** Check A <: B for two wound types.  Variables bound outside
+ *  either one are compared as pointers, so A and B may have
+ *  different parents (e.g. a borrowed type argument and its bound).
+ */
+TracebackP subType(Stack *A, Stack *B) {
+    PROFILE("subType");
+    TracebackP err = subType1(TypeView(A, A->parent), TypeView(B, B->parent));
+    if(!err) return err;
+    return subType(expanded_ast(A), expanded_ast(B));
 }
 
-TracebackP subType1(AstP A, AstP B) {
-    while(B->t != Type::Top) {
-        switch(A->t) {
+static TracebackP subType1(const TypeView &A0, const TypeView &B0) {
+    TypeView A = A0, B = B0;
+    while(B.t() != Type::Top) {
+        if(over_budget()) {
+            return mkError("Out of memory.");
+        }
+        if(!spend_fuel()) {
+            return mkError("Out of fuel.");
+        }
+        switch(A.t()) {
         case Type::Top:
             // Error: B->t is smaller than A
             // note: due to the while-loop, the following is always false:
             //return B->t == Type::Top;
             return mkError("Top is not a subtype of B");
         case Type::Var:
-            if(B->t == Type::Var) {
-                if(A->isPtr == B->isPtr && A->n == B->n) {
+            if(B.t() == Type::Var) {
+                intptr_t na, nb;
+                if(A.var(&na) == B.var(&nb) && na == nb) {
                     return nullptr;
                 }
                 return mkError("A refers to a type variable which differs from B.");
@@ -77,11 +281,11 @@ TracebackP subType1(AstP A, AstP B) {
             return mkError("A refers to a type variable, but B is a value.");
         case Type::Fn:
         case Type::ForAll:
-            if(B->t != A->t) {
+            if(B.t() != A.t()) {
                 return mkError("A and B bind variables differently (Fn vs. ForAll).");
             }
             {
-              TracebackP err = subType1(B->child[0], A->child[0]);
+              TracebackP err = subType1(B.child(0), A.child(0));
               if(err) {
                 // A and B have incompatible arguments
                 // A's argument must be "wider" than B's
@@ -89,8 +293,8 @@ TracebackP subType1(AstP A, AstP B) {
                             os << "Two functions have incompatible arguments (function passed as input is too restrictive).\n";
                          }, std::move(err));
             } }
-            A = A->child[1];
-            B = B->child[1];
+            A = A.child(1);
+            B = B.child(1);
             continue;
         default:
             return mkError("A is not a type!");
@@ -99,6 +303,164 @@ TracebackP subType1(AstP A, AstP B) {
     return nullptr;
 }
 
+/* Instantiation cache.
+ *
+ * The type of a variable applied to arguments, f(:A)(b)..., is
+ * found by winding f's type with the arguments (checking each one
+ * against its bound) and unwinding the result.  That only depends
+ * on f's Bind and on the arguments (types, and the types of terms),
+ * so results are cached per Bind, keyed by the arguments.
+ *
+ * Only closed arguments (without pointer variables) are keys, and
+ * a Bind's type never changes, so an entry stays valid until its
+ * Bind is deleted, which drops it (Bind::inst, inst_forget).
+ * TopEnv binders live as long as the process, so each Bind keeps
+ * only its max_inst_per_bind most recently used entries.  Entries
+ * are charged to the MemBudget current when they are added.
+ * Locked, since parallel eval_need checks arguments on many threads.
+ */
+bool InstStats::enabled = true;
+std::atomic<long> InstStats::hits{0};
+std::atomic<long> InstStats::misses{0};
+std::atomic<long> InstStats::skipped{0};
+std::atomic<long> InstStats::entries{0};
+std::atomic<long> InstStats::bytes{0};
+
+// Entries kept per Bind, least recently used dropped first.
+constexpr size_t max_inst_per_bind = 64;
+
+namespace {
+struct InstSlot;
+typedef std::unordered_map<std::string, InstSlot> InstMap;
+struct InstSlot {
+    AstP type;
+    std::list<InstMap::iterator>::iterator pos; // in InstEntries::lru
+    unsigned budget; // MemBudget charged
+};
+struct InstEntries {
+    InstMap map;
+    std::list<InstMap::iterator> lru; // most recently used first
+};
+struct InstCache {
+    std::mutex m;
+    std::unordered_map<const Bind *, InstEntries> entries;
+};
+InstCache &inst_cache() {
+    static InstCache cache;
+    return cache;
+}
+
+// Approximate size of an entry (its map and list nodes and key).
+long inst_bytes(const std::string &key) {
+    return sizeof(InstMap::value_type) + 2*sizeof(void *)
+         + sizeof(InstMap::iterator) + 2*sizeof(void *)
+         + heap_bytes(key);
+}
+
+void inst_drop(InstMap::iterator it) {
+    mem_refund(it->second.budget, inst_bytes(it->first));
+    --InstStats::entries;
+    InstStats::bytes -= inst_bytes(it->first);
+}
+
+// Cached type for key, or null.  Must hold C.m.
+AstP inst_find(InstCache &C, const Bind *c, const std::string &key) {
+    auto it = C.entries.find(c);
+    if(it == C.entries.end()) return nullptr;
+    InstEntries &E = it->second;
+    auto jt = E.map.find(key);
+    if(jt == E.map.end()) return nullptr;
+    E.lru.splice(E.lru.begin(), E.lru, jt->second.pos);
+    return jt->second.type;
+}
+
+// Add an entry, dropping the least recently used.  Must hold C.m.
+void inst_add(InstCache &C, const Bind *c, const std::string &key,
+              AstP type) {
+    InstEntries &E = C.entries[c];
+    if(E.map.count(key)) return;
+    if(E.map.size() >= max_inst_per_bind) {
+        InstMap::iterator old = E.lru.back();
+        E.lru.pop_back();
+        inst_drop(old);
+        E.map.erase(old);
+    }
+    auto it = E.map.emplace(key, InstSlot()).first;
+    E.lru.push_front(it);
+    it->second.type = type;
+    it->second.pos = E.lru.begin();
+    it->second.budget = mem_charge(inst_bytes(key));
+    ++InstStats::entries;
+    InstStats::bytes += inst_bytes(key);
+}
+} // namespace
+
+void inst_forget(const Bind *c) {
+    InstCache &C = inst_cache();
+    std::lock_guard<std::mutex> lock(C.m);
+    auto it = C.entries.find(c);
+    if(it == C.entries.end()) return;
+    for(auto jt = it->second.map.begin(); jt != it->second.map.end(); ++jt) {
+        inst_drop(jt);
+    }
+    C.entries.erase(it);
+}
+
+void InstStats::print_cache(std::ostream &os) {
+    char line[128];
+    snprintf(line, sizeof(line), "    %-8s %8ld %10ld\n",
+             "Inst", entries.load(), bytes.load());
+    os << line;
+}
+
+void InstStats::print(std::ostream &os) {
+    long h = hits, m = misses, n = skipped;
+    if(h + m + n == 0) return;
+    char line[128];
+    snprintf(line, sizeof(line), "  instantiations: %ld hits, %ld misses,"
+             " %ld not cached (%.1f%% hits)\n", h, m, n,
+             100.0 * h / (h + m + n));
+    os << line;
+}
+
+// Longest key cached (aliases are expanded into the key).
+constexpr size_t max_inst_key = 4096;
+
+// Append a closed Ast to key, expanding aliases.  Returns false
+// if a has any other pointer variable, or the key is too long.
+static bool inst_key(std::string &key, const Ast *a) {
+    if(key.size() > max_inst_key) return false;
+    if(a->t == Type::Var && a->isPtr && isAlias((Bind *)a->n)) {
+        return inst_key(key, get_ast(((Bind *)a->n)->rhs).get());
+    }
+    key.push_back((char)a->t);
+    if(a->t == Type::Var || a->t == Type::var) {
+        if(a->isPtr) return false;
+        key.append((const char *)&a->n, sizeof(a->n));
+        return true;
+    }
+    for(int i=0; i<getNChild(a->t); ++i) {
+        if(!inst_key(key, a->child[i].get())) return false;
+    }
+    return true;
+}
+
+// Key for applying a variable to the arguments app.
+static bool inst_key(std::string &key, Stack *app) {
+    for(; app != nullptr; app = app->next) {
+        if(isType(app->t)) {
+            key.push_back('T');
+            if(!inst_key(key, get_ast(app).get())) return false;
+        } else {
+            ErrorList err; // reported by the wind, if any
+            AstP t = get_type(err, app);
+            key.push_back('t');
+            if(!err.ok() || !inst_key(key, t.get())) return false;
+        }
+    }
+    return true;
+}
+
 // SFold
 // TODO: create a new stack (representing the type),
 // create an application AstP to represent the right-hand sides,
@@ -119,20 +481,7 @@ struct GetType {
             // We'll need to number these later.
             ast = get_ast(s->ref->rht);
             if(s->app != nullptr) {
-                // Pending applications -- need to check that
-                // ast represents the correct function type
-                // and replace ast with the function result
-                // while resolving type variable references
-                // added by application right-hand sides.
-                Stack *ret = new Stack(s);
-                ret->windType(err, ast, s->app);
-                // remove intermediate let-bindings.
-                // alternately, walk ret->ctxt
-                eval_need(ret);
-                ast = get_ast(ret);
-                // TODO: skip ref-count increment + decrement
-                //       during this operation?
-                stack_dtor(ret);
+                ast = instantiate(s, ast);
             }
             break;
         case Type::Top:
@@ -146,6 +495,52 @@ struct GetType {
         }
         return true;
     }
+    /** Type of s->ref (of type ast) applied to s->app,
+     *  from the instantiation cache if possible.
+     */
+    AstP instantiate(Stack *s, AstP ast) {
+        std::string key;
+        bool cache = InstStats::enabled && inst_key(key, s->app);
+        InstCache &C = inst_cache();
+        if(cache) {
+            std::lock_guard<std::mutex> lock(C.m);
+            AstP t = inst_find(C, s->ref, key);
+            if(t) {
+                ++InstStats::hits;
+                return t;
+            }
+        }
+        if(cache) {
+            ++InstStats::misses;
+        } else if(InstStats::enabled) {
+            ++InstStats::skipped;
+        }
+
+        // Pending applications -- need to check that
+        // ast represents the correct function type
+        // and replace ast with the function result
+        // while resolving type variable references
+        // added by application right-hand sides.
+        size_t nerr = err.errors.size();
+        Stack *ret = new Stack(s);
+        ret->detached = true; // changes to ret do not change s
+        ret->windType(err, ast, s->app);
+        // remove intermediate let-bindings.
+        // alternately, walk ret->ctxt
+        bool done = eval_need(ret);
+        ast = get_ast(ret);
+        // TODO: skip ref-count increment + decrement
+        //       during this operation?
+        stack_dtor(ret);
+
+        if(cache && done && err.errors.size() == nerr && !err.full()) {
+            std::lock_guard<std::mutex> lock(C.m);
+            inst_add(C, s->ref, key, ast);
+            s->ref->inst = true;
+        }
+        return ast;
+    }
+
     void bind(Bind *c) {
         if(c->rhs == nullptr) {
             Type tt = c->t;
@@ -172,14 +567,14 @@ struct GetType {
             map[(intptr_t)c] = nbind++;
         }
     }
-    void apply(Stack *b) {
+    void apply(Stack *) {
         // ignore (already dealt with)
     }
 
     /** Change map from counting binder height above head
      *  term mapping depth to term's root (current nbind).
      *
-     *  Then run replaceVars on the current ast.
+     *  Then renumber the current ast with replaceVars.
      *  
      *  example final state of the above unwind op:
      *  nbind = 3
@@ -197,7 +592,8 @@ struct GetType {
      *           = map[BindC] + (ndown-nbind)
      */
     void replace() {
-        replaceVars(ast, map, -nbind);
+        AliasMemo memo;
+        ast = replaceVars(expandAliases(ast, memo), map, -nbind);
     }
 };
 
@@ -205,10 +601,21 @@ struct GetType {
  *  Varibles defined within the stack are replaced by de-Bruijn
  *  indices.  Variables external to the stack are left as
  *  pointers to Bind-s.
+ *
+ *  The result is cached on s, so repeated queries (e.g. from
+ *  Bind::check_rhs and then windStackType::bind) are lookups.
+ *  Only successful results are cached, so errors are re-reported.
  */
 AstP get_type(ErrorList &err, Stack *s) {
+    PROFILE("get_type");
+    if(s->type()) return s->type();
+    if(err.full()) return Top(); // placeholder, never cached
+    size_t nerr = err.errors.size();
     struct GetType h(err);
     unwind(&h, s);
     h.replace();
+    if(err.errors.size() == nerr) {
+        s->extra().type = h.ast;
+    }
     return h.ast;
 }
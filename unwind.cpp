@@ -1,12 +1,19 @@
+#include <algorithm>
+#include <stdexcept>
 #include <utility>
 
 #include "unwind.hpp"
+#include "profile.hpp"
+
+static AstP get_ast(Stack *s, Stack *parent, unsigned long since);
 
 // SFold
 struct GetAst {
     AstP ast;
     Stack *parent;
-    GetAst(Stack *_parent) : parent(_parent) { }
+    unsigned long since; // latest change between the stack and parent
+    GetAst(Stack *_parent, unsigned long _since)
+        : parent(_parent), since(_since) { }
 
     bool val(Stack *s) {
         ast = std::make_shared<Ast>(s->t);
@@ -14,6 +21,7 @@ struct GetAst {
         case Type::Var:
         case Type::var: // re-number variable ref-s
             ast->isPtr = s->number_var(&ast->n, s->ref, parent);
+            if(ast->isPtr) ast->name = s->ref->name;
             break;
         case Type::top:
         case Type::Top:
@@ -28,7 +36,16 @@ struct GetAst {
         ast = std::make_shared<Ast>(
                     c->t, c->name,
                          get_ast_sub(c->rht), ast);
-        if(c->rhs != nullptr) {
+        if(c->rhs != nullptr && c->borrowed) {
+            // Numbered relative to its own parent, which must be
+            // ours, or the numbering would mix pointers and
+            // indices (Bind::borrowed).
+            if(c->rhs->parent != parent) {
+                throw std::runtime_error("Borrowed type argument"
+                                         " unwound outside its parent.");
+            }
+            ast = appT(ast, get_ast(c->rhs));
+        } else if(c->rhs != nullptr) {
             apply(c->rhs);
         }
     }
@@ -46,10 +63,41 @@ struct GetAst {
      *  remains locally nameless with no change in scoping.
      */
     AstP get_ast_sub(Stack *s) {
-        return get_ast(s, parent);
+        return get_ast(s, parent, since);
     }
 };
 
+/* Cached get_ast.
+ *
+ * get_ast(s, parent) depends on s and its sub-stacks, and on the
+ * binders of the stacks between s and parent (s->parent, ...,
+ * excluding parent itself).  Changes to s and its sub-stacks clear
+ * s->x->ast (Stack::modified).  Changes to the stacks in between
+ * are caught by `since`, the latest time any of them was modified.
+ * Only stacks with a StackExtra record their changes, so every
+ * stack a cached result depends on is given one.
+ *
+ * Hits return the cached Ast itself, so get_ast results are
+ * shared and must not be modified.
+ */
+static AstP get_ast(Stack *s, Stack *parent, unsigned long since) {
+    StackExtra *x = s->x;
+    if(x && x->ast != nullptr && x->ast_parent == parent
+            && x->ast_time >= since) {
+        return x->ast;
+    }
+    PROFILE("get_ast");
+    struct GetAst h(parent, std::max(since, x ? x->changed : 0));
+    unwind(&h, s);
+    if(Stack::cache_ast) {
+        x = &s->extra();
+        x->ast = h.ast;
+        x->ast_parent = parent;
+        x->ast_time = Stack::clock;
+    }
+    return h.ast;
+}
+
 /** Create a "locally nameless" Ast for the given stack.
  *  Varibles defined within the stack are replaced by de-Bruijn
  *  indices.  Variables external to the stack are left as
@@ -63,9 +111,12 @@ AstP get_ast(Stack *s) {
  *  "parent", but uses de-Bruijn indices otherwise.
  */
 AstP get_ast(Stack *s, Stack *parent) {
-    struct GetAst h(parent);
-    unwind(&h, s);
-    return h.ast;
+    unsigned long since = 0;
+    for(Stack *p = s->parent; p != parent && p != nullptr; p = p->parent) {
+        if(Stack::cache_ast) p->extra();
+        if(p->x) since = std::max(since, p->x->changed);
+    }
+    return get_ast(s, parent, since);
 }
 
 /* Garbage collection fold. */
@@ -90,7 +141,7 @@ struct StackDtor {
     void bind(Bind *c) {
         if(c->rht != nullptr)
             stack_dtor(c->rht);
-        if(c->rhs != nullptr)
+        if(c->rhs != nullptr && !c->borrowed)
             stack_dtor(c->rhs);
         spine->ctxt = c->next; // remove binder from context
         delete c;
@@ -103,6 +154,8 @@ struct StackDtor {
 };
 
 void stack_dtor(Stack *s) {
+    PROFILE("stack_dtor");
+    s->modified(); // s is removed from the stacks containing it
     struct StackDtor dtor(s);
     unwind(&dtor, s);
     delete s;
@@ -1,10 +1,38 @@
 #pragma once
 
+#include <map>
+
 #include "ast.hpp"
 #include "stack.hpp"
 
 void stack_dtor(Stack *s);
-void eval_need(Stack *s);
+bool eval_need(Stack *s);
+struct Pool;
+bool eval_need_parallel(Stack *s, Pool &pool, long cutoff = 64);
 AstP get_ast(Stack *s);
 AstP get_ast(Stack *s, Stack *parent);
 AstP get_type(ErrorList &err, Stack *s);
+TracebackP subType(AstP A, Stack *B);
+TracebackP subType(Stack *A, Stack *B);
+AstP replaceVars(AstP a, const std::map<intptr_t,int> &map, int ndown);
+
+// type.cpp: cache of instantiated types, see GetType::val
+struct InstStats {
+    static bool enabled;
+    static std::atomic<long> hits;
+    static std::atomic<long> misses;
+    static std::atomic<long> skipped; ///< arguments were not closed
+    static std::atomic<long> entries; ///< live cache entries
+    static std::atomic<long> bytes;   ///< and their approximate size
+    static void print(std::ostream &os);
+    // One line of the --mem table (MemStats::print).
+    static void print_cache(std::ostream &os);
+};
+void inst_forget(const Bind *c); // drop c's entries
+
+// pprint.cpp
+struct PrintLimits {
+    int max_depth = -1; ///< nesting depth of Stacks (-1 = unlimited)
+    long max_size = -1; ///< number of Stacks and binders printed
+};
+void print_stack(std::ostream &os, Stack *s, const PrintLimits &lim = {});
@@ -0,0 +1,120 @@
+#include <vector>
+
+#include "ast.hpp"
+
+/* Usage analysis over numbered Ast-s.
+ *
+ * Runs before winding, so that let-bindings whose variable
+ * is never referenced, app(fn(x:A) b, rhs) or appT(fnT(X<:A) b, B),
+ * are replaced by b.  Their rhs and annotation are then never
+ * wound, checked or evaluated.
+ */
+
+// Copy of `a` with new children, or `a` itself if they are unchanged.
+static AstP rebuild(AstP a, AstP c0, AstP c1) {
+    if(c0 == a->child[0] && c1 == a->child[1]) return a;
+    AstP y = std::make_shared<Ast>(a->t, a->name, c0, c1);
+    y->isPtr = a->isPtr;
+    y->n = a->n;
+    y->err = a->err;
+    return y;
+}
+
+/** Add d to every de-Bruijn index that points outside
+ *  the first `cutoff` binders of a.
+ */
+AstP shift(AstP a, int d, int cutoff) {
+    switch(a->t) {
+    case Type::Var:
+    case Type::var:
+        if(a->isPtr || a->n < cutoff) return a;
+        {
+            AstP y = std::make_shared<Ast>(a->t, a->name);
+            y->n = a->n + d;
+            y->err = a->err;
+            return y;
+        }
+    default:
+        break;
+    }
+    int n = getNChild(a->t);
+    if(n == 0) return a;
+    AstP c0 = shift(a->child[0], d, cutoff);
+    AstP c1 = shift(a->child[1], d, isBind(a->t) ? cutoff+1 : cutoff);
+    return rebuild(a, c0, c1);
+}
+
+/* Rewrites a bottom-up.  uses[i] counts references to the
+ * i-th enclosing binder (counting from the root), so a binder's
+ * count is complete once its body has been rewritten.
+ *
+ * The body of a let is visited before its rhs, and the rhs
+ * only if the binder turns out to be used.  References from dead
+ * right-hand sides therefore do not keep outer binders alive, and
+ * chains of dead lets are removed in one pass.
+ */
+struct DropDead {
+    std::vector<int> uses;
+    int ndropped = 0;
+
+    static bool isLet(AstP a) {
+        AstP f = a->child[0];
+        return (a->t == Type::app && f->t == Type::fn)
+            || (a->t == Type::appT && f->t == Type::fnT);
+    }
+
+    AstP run(AstP a) {
+        switch(a->t) {
+        case Type::Var:
+        case Type::var:
+            if(!a->isPtr && a->n >= 0 && a->n < (intptr_t)uses.size()) {
+                ++uses[uses.size()-1-a->n];
+            }
+            return a;
+        case Type::app:
+        case Type::appT:
+            if(isLet(a)) return let(a);
+            break;
+        default:
+            break;
+        }
+        int n = getNChild(a->t);
+        if(n == 0) return a;
+        AstP c0 = run(a->child[0]);
+        if(!isBind(a->t)) {
+            return rebuild(a, c0, run(a->child[1]));
+        }
+        uses.push_back(0);
+        AstP c1 = run(a->child[1]);
+        uses.pop_back();
+        return rebuild(a, c0, c1);
+    }
+
+    AstP let(AstP a) {
+        AstP f = a->child[0];
+        uses.push_back(0);
+        AstP body = run(f->child[1]);
+        int n = uses.back();
+        uses.pop_back();
+        if(n == 0) {
+            ++ndropped;
+            return shift(body, -1, 0);
+        }
+        AstP A = run(f->child[0]);
+        AstP rhs = run(a->child[1]);
+        return rebuild(a, rebuild(f, A, body), rhs);
+    }
+};
+
+/** Remove let-bindings whose variable is unused from the
+ *  numbered Ast `a`.  Shares all unchanged sub-trees with `a`.
+ *
+ *  If ndropped is non-null, the number of removed binders
+ *  is stored there.
+ */
+AstP drop_dead_lets(AstP a, int *ndropped) {
+    DropDead D;
+    AstP b = D.run(a);
+    if(ndropped) *ndropped = D.ndropped;
+    return b;
+}